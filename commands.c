@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,8 +13,20 @@
 #include <fcntl.h>
 
 #include "commands.h"
+#include "jobs.h"
+#include "spawn.h"
+#include "stats.h"
+#include "timer.h"
+#include "wildcard.h"
 
-int allowBackground = 1;
+#define MAX_COPROC 16
+#define COPROC_NAME 32
+#define COPROC_BUF 4096 // longest line coproc -r returns whole
+
+Session *currentSession = NULL; // session the signal handlers act on
+int commandDepth = 0;            // runCommand() calls in progress
+int shellStdout = -1;            // descriptors of the outermost runCommand()
+int shellStdin = -1;             // from before its redirections
 
 struct BackArr
 {
@@ -22,6 +35,21 @@ struct BackArr
     int capacity;
 };
 
+// a coprocess started by the coproc built in, fd[0]
+// reads the helper's output and fd[1] writes its input,
+// once reaped fd[0] stays open until coproc -c NAME
+struct Coproc
+{
+    char name[COPROC_NAME];
+    pid_t pid;
+    int exited;
+    int fd[2];
+    char *buf;  // output read by coproc -r past the line it returned
+    int bufLen;
+};
+
+struct Coproc coprocs[MAX_COPROC];
+
 /*************************************************
 Function: catchSIGINT()
 Description: catches the SIGINT signal and prints
@@ -42,31 +70,113 @@ flag
 *************************************************/
 void catchSIGTSTP(int signo)
 {
-    if (allowBackground)
+    if (currentSession == NULL)
+    {
+        return;
+    }
+
+    if (currentSession->allowBackground)
     {
         char *message = "\nEntering foreground-only mode (& is now ignored)\n: ";
         write(STDOUT_FILENO, message, 52);
-        allowBackground = 0; // no background process can be run
+        currentSession->allowBackground = 0; // no background process can be run
     }
     else
     {
         char *message = "\nExiting foreground-only mode\n: ";
         write(STDOUT_FILENO, message, 32);
-        allowBackground = 1; // background processes can be run
+        currentSession->allowBackground = 1; // background processes can be run
     }
 
     fflush(stdout);
 }
 
 /*************************************************
-Function: shellForeground()
-Description: immediately runs non-built-in
-commands in the foreground of the shell
+Function: newSession()
+Description: allocates a session with an empty
+background array and makes it the one the signal
+handlers act on
 *************************************************/
-int shellForeground(char **args)
+Session *newSession()
+{
+    Session *s = (Session *)malloc(sizeof(Session));
+    s->status = 0;
+    s->allowBackground = 1;
+    s->jobs = newBackArr(4);
+    s->served = 0;
+    s->exited = 0;
+
+    currentSession = s;
+    return s;
+}
+
+/*************************************************
+Function: deleteSession()
+Description: frees the session and its background
+array
+*************************************************/
+void deleteSession(Session *s)
+{
+    if (currentSession == s)
+    {
+        currentSession = NULL;
+    }
+
+    deleteBackArr(s->jobs);
+    free(s);
+}
+
+/*************************************************
+Function: catchSIGCHLD()
+Description: notes when a child exits so the delay
+until checkState() reaps it can be measured
+*************************************************/
+void catchSIGCHLD(int signo, siginfo_t *info, void *context)
+{
+    noteChildExit(info->si_pid, nowNanos());
+}
+
+/*************************************************
+Function: startChild()
+Description: starts a command through the spawn
+helper or with fork and exec, and records the time
+from the fork until the exec, flags are SPAWN_SEARCH
+and SPAWN_GROUP, a pending timeout is armed here
+*************************************************/
+int startChild(char **args, int flags)
 {
     pid_t childPid;
-    int childStatus;
+    int execPipe[2];
+    char byte;
+    long long start = nowNanos();
+
+    // a timed command leads its own group so the deadline
+    // reaches anything it starts
+    if (timeoutPending())
+    {
+        flags |= SPAWN_GROUP;
+    }
+
+    // let the spawn helper fork if it is running, it only
+    // replies once the command has been exec'd
+    if ((childPid = helperSpawn(args, flags)) > 0)
+    {
+        recordLatency(HIST_FORK_EXEC, nowNanos() - start);
+        armTimeout(childPid);
+        return childPid;
+    }
+
+    // both ends close when the child execs, so end of
+    // file on the read end marks the exec
+    if (pipe(execPipe) == -1)
+    {
+        execPipe[0] = -1;
+    }
+    else
+    {
+        fcntl(execPipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(execPipe[1], F_SETFD, FD_CLOEXEC);
+    }
 
     switch (childPid = fork())
     {
@@ -76,18 +186,89 @@ int shellForeground(char **args)
         exit(1);
         break;
     case 0: // handle error with command
-        if (execv(args[0], args) == -1)
+        if (flags & SPAWN_GROUP)
         {
-            perror("smallsh");
-            fflush(stdout);
-            exit(1);
-        };
-        break;
-    default: // if no errors, fork process
-        do
+            setpgid(0, 0);
+        }
+
+        if (flags & SPAWN_SEARCH)
         {
-            childPid = waitpid(childPid, &childStatus, WUNTRACED);
-        } while (!WIFEXITED(childStatus) && !WIFSIGNALED(childStatus));
+            execvp(args[0], args);
+        }
+        else
+        {
+            execv(args[0], args);
+        }
+        perror("smallsh");
+        fflush(stdout);
+        exit(1);
+    }
+
+    if (execPipe[0] != -1)
+    {
+        close(execPipe[1]);
+        while (read(execPipe[0], &byte, 1) == -1 && errno == EINTR)
+            ;
+        close(execPipe[0]);
+        recordLatency(HIST_FORK_EXEC, nowNanos() - start);
+    }
+
+    // set it here too so it holds before the deadline can fire
+    if (flags & SPAWN_GROUP)
+    {
+        setpgid(childPid, childPid);
+    }
+
+    armTimeout(childPid);
+    return childPid;
+}
+
+/*************************************************
+Function: shellForeground()
+Description: immediately runs non-built-in
+commands in the foreground of the shell
+*************************************************/
+int shellForeground(char **args)
+{
+    pid_t childPid;
+    int childStatus;
+    long long start;
+
+    // a timed command leads its own group, which needs the
+    // terminal to read from it and to get ^C
+    int tty = -1;
+    if (timeoutPending() && isatty(shellStdin) && tcgetpgrp(shellStdin) == getpgrp())
+    {
+        tty = shellStdin;
+    }
+
+    childPid = startChild(args, 0);
+
+    if (tty != -1)
+    {
+        tcsetpgrp(tty, childPid);
+        kill(-childPid, SIGCONT); // in case it read before it had the terminal
+    }
+
+    start = nowNanos();
+    waitForeground(childPid, &childStatus);
+    recordLatency(HIST_FOREGROUND, nowNanos() - start);
+
+    if (tty != -1)
+    {
+        // the shell is in the background now, so SIGTTOU
+        // would stop it while it takes the terminal back
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTTOU);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
+        tcsetpgrp(tty, getpgrp());
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    }
+
+    if (cancelDeadline(childPid))
+    {
+        childStatus |= STATUS_TIMED_OUT;
     }
 
     return childStatus; // return child status for output
@@ -99,31 +280,20 @@ Description: runs non-built-in commands in the
 background of the shell, adds the PIDs to an array,
 and redirects output to the standard output
 *************************************************/
-void shellBackground(char **args, BackArr *v, int stdOut)
+int shellBackground(char **args, BackArr *v, int stdOut)
 {
     pid_t childPid;
 
-    childPid = fork();
-
-    if (childPid == -1) // handle error creating fork
-    {
-        perror("smallsh");
-        fflush(stdout);
-        exit(1);
-    }
-    else if (childPid == 0)
-    {
-        if (execvp(args[0], args) == -1) // handle error with command
-        {
-            perror("smallsh");
-            fflush(stdout);
-        }
-    }
+    childPid = startChild(args, SPAWN_SEARCH);
 
-    addBackArr(v, childPid); // add pid to array to keep track
-    dup2(stdOut, 1);         // reset standard output so can print the background pid
+    addBackArr(v, childPid);      // add pid to array to keep track
+    addJob(childPid, args);       // and give it a job number
+    noteBackgroundJobs(v->size);  // for the peak in stats
+    dup2(stdOut, 1);              // reset standard output so can print the background pid
     printf("background pid is %d\n", childPid);
     fflush(stdout);
+
+    return childPid;
 }
 
 /*************************************************
@@ -152,38 +322,148 @@ int checkState(BackArr *v)
 {
     int childStatus;
 
+    drainJobs(); // collect output of jobs with a capture pipe
+
     // loops through each pid in the background array
     for (int i = 0; i < v->size; i++)
     {
         // if the process is completed, print the message and exit value
-        if (waitpid(v->process[i], &childStatus, WNOHANG))
+        if (waitChild(v->process[i], &childStatus, WNOHANG))
         {
+            // the deadline of a timed job goes once it is reaped
+            char *timedOut = cancelDeadline(v->process[i]) ? "timed out, " : "";
+
             if (WIFEXITED(childStatus)) // exited
             {
-                printf("background pid %d is done: exit value %d\n", v->process[i], WEXITSTATUS(childStatus));
+                printf("background pid %d is done: %sexit value %d\n", v->process[i], timedOut, WEXITSTATUS(childStatus));
             }
             else // terminated
             {
-                printf("background pid %d is done: terminated by signal %d\n", v->process[i], WTERMSIG(childStatus));
+                printf("background pid %d is done: %sterminated by signal %d\n", v->process[i], timedOut, WTERMSIG(childStatus));
             }
             fflush(stdout);
+
+            // how long the job sat finished before being reaped
+            long long exited = childExitTime(v->process[i]);
+            if (exited)
+            {
+                recordLatency(HIST_REAP_LAG, nowNanos() - exited);
+            }
+
+            closeCoproc(v->process[i]);      // release pipes if it was a coprocess
+            finishJob(v->process[i], childStatus);
             removeBackArr(v, v->process[i]); // remove from process array
+            i--;                             // next pid has shifted into this slot
         }
     }
+
+    startScheduled(); // jobs queued by after may be free to run now
     return 1;
 }
 
+/*************************************************
+Function: shellFds()
+Description: while a command is part way through
+its redirections, swaps the descriptors of the
+shell back in, saving the command's in saved, which
+restoreFds() puts back
+*************************************************/
+static void shellFds(int saved[2])
+{
+    saved[0] = -1;
+    saved[1] = -1;
+    if (commandDepth > 0)
+    {
+        saved[0] = dup(STDIN_FILENO);
+        saved[1] = dup(STDOUT_FILENO);
+        dup2(shellStdin, STDIN_FILENO);
+        dup2(shellStdout, STDOUT_FILENO);
+    }
+}
+
+/*************************************************
+Function: restoreFds()
+Description: undoes shellFds()
+*************************************************/
+static void restoreFds(int saved[2])
+{
+    if (saved[0] != -1)
+    {
+        dup2(saved[0], STDIN_FILENO);
+        dup2(saved[1], STDOUT_FILENO);
+        close(saved[0]);
+        close(saved[1]);
+    }
+}
+
+/*************************************************
+Function: reapJobs()
+Description: reaps the background jobs of the
+current session while the shell is waiting on
+something else, so jobs queued by after start as
+soon as what they wait for has exited
+*************************************************/
+void reapJobs()
+{
+    int saved[2];
+
+    if (currentSession != NULL)
+    {
+        shellFds(saved);
+        checkState(currentSession->jobs);
+        restoreFds(saved);
+    }
+}
+
+/*************************************************
+Function: startScheduled()
+Description: runs every job queued by after that
+is ready in the background, with the descriptors
+of the shell rather than those of a command part
+way through its redirections
+*************************************************/
+void startScheduled()
+{
+    static int starting = 0;
+    Session *s = currentSession;
+    int saved[2];
+    char *line;
+
+    // a pending timeout belongs to the command being run
+    if (s == NULL || starting || timeoutPending())
+    {
+        return;
+    }
+    starting = 1;
+
+    shellFds(saved);
+    int allowBackground = s->allowBackground;
+    s->allowBackground = 1; // queued jobs always run in the background
+    while ((line = nextReadyJob()) != NULL)
+    {
+        runCommand(line, s);
+        endAdopt();
+        free(line);
+    }
+    s->allowBackground = allowBackground;
+    restoreFds(saved);
+    starting = 0;
+}
+
 /*************************************************
 Function: runCommand()
 Description: this function coordinates the running
 of commands, including deciding if a built in 
 command, checking if background or foreground, and
-replacing the instances of $$ with the pid 
+replacing the instances of $$ with the pid, the
+status is kept in the session for the next call
 *************************************************/
-int runCommand(char *c, int prevStatus, BackArr *v)
+int runCommand(char *c, Session *s)
 {
     char **args;
     char **temp;
+    BackArr *v = s->jobs;
+    int prevStatus = s->status;
     int status = prevStatus;
     int stdoutCopy = dup(STDOUT_FILENO);
     int stdinCopy = dup(STDIN_FILENO);
@@ -191,17 +471,64 @@ int runCommand(char *c, int prevStatus, BackArr *v)
     int outRedirect = 0; // flag that output has been redirected
     int inRedirect = 0;  // flag that input has been redirected
 
+    if (commandDepth++ == 0)
+    {
+        shellStdout = stdoutCopy;
+        shellStdin = stdinCopy;
+    }
+
+    // timeout keeps a deadline for the command after it
+    if (!strncmp(c, "timeout ", 8))
+    {
+        countCommand(STAT_TIMEOUT);
+        c = timeoutCustom(c + 8);
+    }
+
     // first checks if the command is a built in one
-    if (!strcmp(c, "exit"))
+    if (c == NULL)
     {
-        exitCustom(v);
+        // timeout has already printed its usage
+    }
+    else if (!strcmp(c, "exit"))
+    {
+        countCommand(STAT_EXIT);
+        if (s->served)
+        {
+            s->exited = 1; // runSession() replies and then exits
+        }
+        else
+        {
+            exitCustom(v);
+        }
+    }
+    else if (!strcmp(c, "jobs") || !strncmp(c, "jobs ", 5))
+    {
+        countCommand(STAT_JOBS);
+        jobsCustom(c);
+    }
+    else if (!strcmp(c, "stats") || !strncmp(c, "stats ", 6))
+    {
+        countCommand(STAT_STATS);
+        statsCustom(c);
+    }
+    else if (!strncmp(c, "after ", 6))
+    {
+        countCommand(STAT_AFTER);
+        afterCustom(c);
+    }
+    else if (!strncmp(c, "coproc ", 7))
+    {
+        countCommand(STAT_COPROC);
+        coprocCustom(c + 7, v, stdoutCopy);
     }
     else if (strstr(c, "cd") != NULL)
     {
+        countCommand(STAT_CD);
         cdCustom(c);
     }
     else if (strstr(c, "status") != NULL)
     {
+        countCommand(STAT_STATUS);
         statusCustom(prevStatus);
     }
     else // not a built in command
@@ -210,6 +537,13 @@ int runCommand(char *c, int prevStatus, BackArr *v)
         args = parseCommand(c, numptr); // parsing the command
         int numArgs = *numptr;          // save the number of arguments
 
+        // replace any ${NAME[0]} or ${NAME[1]} with the coprocess
+        // fd so it can be used as a redirection target
+        for (int i = 0; i < numArgs; i++)
+        {
+            args[i] = expandCoproc(args[i]);
+        }
+
         for (int i = 0; i < numArgs; i++)
         {
             // if identify an output redirection operator
@@ -269,6 +603,9 @@ int runCommand(char *c, int prevStatus, BackArr *v)
             }
         }
 
+        // expand *, ?, [...] and ** patterns in the arguments
+        args = expandWildcards(args, &numArgs);
+
         // allocate a temporary string
         temp = malloc(numArgs * sizeof(char **));
 
@@ -280,20 +617,50 @@ int runCommand(char *c, int prevStatus, BackArr *v)
             {
                 temp[j] = args[j];
             }
+            temp[numArgs - 1] = NULL;
 
-            if (allowBackground)
+            if (s->allowBackground)
             {
+                int capture[2] = {-1, -1};
+                int stderrCopy = -1;
+
+                // with --capture, stdout and stderr go to a pipe that
+                // is drained into the job's ring instead of /dev/null
+                if (captureOutput && pipe(capture) == 0)
+                {
+                    fcntl(capture[0], F_SETFD, FD_CLOEXEC);
+                    fcntl(capture[0], F_SETFL, O_NONBLOCK);
+                    stderrCopy = dup(STDERR_FILENO);
+
+                    if (!outRedirect)
+                    {
+                        dup2(capture[1], 1);
+                        outRedirect = 1;
+                    }
+                    dup2(capture[1], 2);
+                    close(capture[1]);
+                }
+
                 // if the background command hasn't been redirected
                 // backgroundRedirect() will redirect to /dev/null
                 backgroundRedirect(outRedirect, inRedirect);
                 // run the command in the background
-                shellBackground(temp, v, stdoutCopy);
+                countCommand(STAT_BACKGROUND);
+                pid_t childPid = shellBackground(temp, v, stdoutCopy);
+
+                if (capture[0] != -1)
+                {
+                    setJobOutput(childPid, capture[0]);
+                    dup2(stderrCopy, 2);
+                    close(stderrCopy);
+                }
             }
             else
             {
                 // if background is not allowed, then just run it
                 // in the foreground
                 checkState(v);
+                countCommand(STAT_FOREGROUND);
                 status = shellForeground(temp);
             }
         }
@@ -302,6 +669,7 @@ int runCommand(char *c, int prevStatus, BackArr *v)
         else
         {
             checkState(v);
+            countCommand(STAT_FOREGROUND);
             status = shellForeground(args);
         }
     }
@@ -309,7 +677,17 @@ int runCommand(char *c, int prevStatus, BackArr *v)
     // redirect back to the standard input and output
     dup2(stdoutCopy, 1);
     dup2(stdinCopy, 0);
+    close(stdoutCopy);
+    close(stdinCopy);
+
+    // a timeout in front of a built in is not kept for later
+    clearTimeout();
 
+    s->status = status;
+    if (--commandDepth == 0)
+    {
+        startScheduled(); // including jobs queued by this command
+    }
     return status;
 }
 
@@ -340,26 +718,52 @@ char *trimWhiteSpace(char *c)
 }
 
 /*************************************************
-Function: exitCustom()
-Description: first deletes all the background
-processes, and then exits the shell
+Function: killJobs()
+Description: kills every background process of the
+shell and frees the background array
 *************************************************/
-void exitCustom(BackArr *v)
+void killJobs(BackArr *v)
 {
     // killing all background process in array
     for (int i = 0; i < v->size; i++)
     {
         kill(v->process[i], SIGKILL);
+        kill(-v->process[i], SIGKILL); // group of a timed job
     }
 
     // freeing memory of array
     deleteBackArr(v);
+}
+
+/*************************************************
+Function: exitCustom()
+Description: first deletes all the background
+processes, and then exits the shell
+*************************************************/
+void exitCustom(BackArr *v)
+{
+    killJobs(v);
 
     // killing the entire shell
     kill(0, SIGKILL);
     exit(0);
 }
 
+/*************************************************
+Function: exitCode()
+Description: turns a status as kept in the session
+into an exit code, the exit value, 128 plus the
+terminating signal, or 124 if timeout stopped it
+*************************************************/
+int exitCode(int status)
+{
+    if (status & STATUS_TIMED_OUT)
+    {
+        return 124;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
 /*************************************************
 Function: cdCustom()
 Description: built-in cd function that implements
@@ -414,6 +818,11 @@ the status functionality
 *************************************************/
 void statusCustom(int status)
 {
+    if (status & STATUS_TIMED_OUT) // stopped by timeout
+    {
+        printf("timed out, ");
+    }
+
     if (WIFEXITED(status)) // if exited
     {
         printf("exit value %d\n", WEXITSTATUS(status));
@@ -434,6 +843,7 @@ char **parseCommand(char *c, int *num)
 {
     int buf = 64;
     int pos = 0;
+    long long start = nowNanos();
 
     char **tokens = malloc(buf * sizeof(char *));
     char *token;
@@ -471,6 +881,7 @@ char **parseCommand(char *c, int *num)
         tokens[0] = addPrefix;
     };
 
+    recordLatency(HIST_PARSE, nowNanos() - start);
     return tokens;
 };
 
@@ -490,7 +901,7 @@ char *getPath()
         i++;
     }
 
-    temp = malloc(i * sizeof(char *));
+    temp = malloc(i + 2); // room for the trailing / and \0
 
     // copying until it gets to the first
     // ":" value
@@ -500,6 +911,7 @@ char *getPath()
     }
 
     temp[i] = '/';
+    temp[i + 1] = '\0';
     return temp;
 }
 
@@ -526,9 +938,17 @@ int redirectOutput(char **args, int index)
     {
         perror("dup2");
         fflush(stdout);
+        close(file);
         return 1;
     }
 
+    // only the copy is kept, the original would leak into
+    // the shell and every later child
+    if (file != 1)
+    {
+        close(file);
+    }
+
     return 0;
 }
 
@@ -555,9 +975,17 @@ int redirectInput(char **args, int index)
     {
         perror("dup2");
         fflush(stdout);
+        close(file);
         return 1;
     }
 
+    // only the copy is kept, the original would leak into
+    // the shell and every later child
+    if (file != 0)
+    {
+        close(file);
+    }
+
     return 0;
 }
 
@@ -614,3 +1042,416 @@ int backgroundRedirect(int out, int in)
     }
     return 0;
 }
+
+/*************************************************
+Function: freeCoproc()
+Description: closes whatever is left of a
+coprocess's pipes and frees its name
+*************************************************/
+static void freeCoproc(struct Coproc *cp)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (cp->fd[i] != -1)
+        {
+            close(cp->fd[i]);
+        }
+    }
+    free(cp->buf);
+    cp->buf = NULL;
+    cp->bufLen = 0;
+    cp->pid = 0;
+    cp->exited = 0;
+    cp->name[0] = '\0';
+}
+
+/*************************************************
+Function: findCoproc()
+Description: finds a coprocess by name, printing an
+error if there is none
+*************************************************/
+static struct Coproc *findCoproc(const char *name)
+{
+    for (int i = 0; i < MAX_COPROC; i++)
+    {
+        if (coprocs[i].pid != 0 && !strcmp(coprocs[i].name, name))
+        {
+            return &coprocs[i];
+        }
+    }
+
+    printf("coproc: no such coprocess: %s\n", name);
+    fflush(stdout);
+    return NULL;
+}
+
+/*************************************************
+Function: writeCoproc()
+Description: coproc -w NAME line, writes the line
+to the coprocess with a single write, so talking to
+it costs no process
+*************************************************/
+static void writeCoproc(char *c)
+{
+    char *name = c;
+    struct sigaction ignore = {{0}};
+    struct sigaction old;
+
+    while (*c && !isspace((unsigned char)*c))
+        c++;
+    if (*c != '\0')
+    {
+        *c++ = '\0';
+    }
+
+    struct Coproc *cp = findCoproc(name);
+    if (cp == NULL)
+    {
+        return;
+    }
+
+    if (cp->fd[1] == -1)
+    {
+        printf("coproc: input of %s is closed\n", name);
+        fflush(stdout);
+        return;
+    }
+
+    size_t len = strlen(c);
+    char *line = malloc(len + 2);
+    memcpy(line, c, len);
+    line[len++] = '\n';
+
+    // a coprocess that has quit must not take the shell with it
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &old);
+
+    for (size_t done = 0; done < len;)
+    {
+        ssize_t n = write(cp->fd[1], line + done, len - done);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("coproc");
+            fflush(stdout);
+            break;
+        }
+        done += n;
+    }
+
+    sigaction(SIGPIPE, &old, NULL);
+    free(line);
+}
+
+/*************************************************
+Function: readCoproc()
+Description: coproc -r NAME, prints the next line
+of the coprocess's output, reading a block at a time
+and keeping what follows the line for the next call,
+so lines are not lost the way they are by head
+reading past them, output kept here is no longer
+in ${NAME[0]}
+*************************************************/
+static void readCoproc(char *name)
+{
+    struct Coproc *cp = findCoproc(name);
+    char *newline;
+
+    if (cp == NULL)
+    {
+        return;
+    }
+
+    if (cp->buf == NULL)
+    {
+        cp->buf = malloc(COPROC_BUF);
+    }
+
+    while ((newline = memchr(cp->buf, '\n', cp->bufLen)) == NULL && cp->bufLen < COPROC_BUF)
+    {
+        ssize_t n = read(cp->fd[0], cp->buf + cp->bufLen, COPROC_BUF - cp->bufLen);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        cp->bufLen += n;
+    }
+
+    if (cp->bufLen == 0)
+    {
+        printf("coproc: end of output from %s\n", name);
+        fflush(stdout);
+        return;
+    }
+
+    // a line longer than the buffer comes back in pieces,
+    // a last line without a newline gets one
+    int len = newline != NULL ? newline - cp->buf + 1 : cp->bufLen;
+    fflush(stdout);
+    write(STDOUT_FILENO, cp->buf, len);
+    if (newline == NULL)
+    {
+        write(STDOUT_FILENO, "\n", 1);
+    }
+
+    cp->bufLen -= len;
+    memmove(cp->buf, cp->buf + len, cp->bufLen);
+}
+
+/*************************************************
+Function: coprocCustom()
+Description: built-in coproc function that starts
+the command once in the background with its input
+and output connected to the shell by two pipes, the
+shell's ends are exposed as ${NAME[0]} for reading
+and ${NAME[1]} for writing, coproc -c NAME closes
+${NAME[1]} so the coprocess sees end of file, and
+once it has exited also ${NAME[0]}, freeing the name,
+coproc -w NAME line and coproc -r NAME write a line
+to it and read one from it without starting a process
+*************************************************/
+void coprocCustom(char *c, BackArr *v, int stdOut)
+{
+    char **args;
+    char *name = c;
+    int numArgs;
+    int slot = -1;
+    int toShell[2];   // helper's output read by the shell
+    int fromShell[2]; // shell's writes read by the helper
+
+    // split the name from the command
+    while (*c && !isspace((unsigned char)*c))
+        c++;
+
+    if (*c == '\0')
+    {
+        printf("coproc: usage: coproc NAME command | coproc -c|-r NAME | coproc -w NAME line\n");
+        fflush(stdout);
+        return;
+    }
+
+    *c = '\0';
+    c = trimWhiteSpace(c + 1);
+
+    if (!strcmp(name, "-c"))
+    {
+        closeCoprocInput(c);
+        return;
+    }
+
+    if (!strcmp(name, "-w"))
+    {
+        writeCoproc(c);
+        return;
+    }
+
+    if (!strcmp(name, "-r"))
+    {
+        readCoproc(c);
+        return;
+    }
+
+    if (strlen(name) >= COPROC_NAME)
+    {
+        printf("coproc: name too long: %s\n", name);
+        fflush(stdout);
+        return;
+    }
+
+    // find a free slot, only one coprocess per name, one
+    // that has exited gives up its unread output to a new one
+    for (int i = 0; i < MAX_COPROC; i++)
+    {
+        if (coprocs[i].pid != 0 && coprocs[i].exited && !strcmp(coprocs[i].name, name))
+        {
+            freeCoproc(&coprocs[i]);
+        }
+
+        if (coprocs[i].pid == 0)
+        {
+            if (slot == -1)
+            {
+                slot = i;
+            }
+        }
+        else if (!strcmp(coprocs[i].name, name))
+        {
+            printf("coproc: %s is already running\n", name);
+            fflush(stdout);
+            return;
+        }
+    }
+
+    if (slot == -1)
+    {
+        printf("coproc: too many coprocesses\n");
+        fflush(stdout);
+        return;
+    }
+
+    if (pipe(toShell) == -1)
+    {
+        perror("pipe");
+        fflush(stdout);
+        return;
+    }
+
+    if (pipe(fromShell) == -1)
+    {
+        perror("pipe");
+        fflush(stdout);
+        close(toShell[0]);
+        close(toShell[1]);
+        return;
+    }
+
+    // keep the shell's ends out of every other child, otherwise
+    // the helper never sees end of file on its input
+    fcntl(toShell[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fromShell[1], F_SETFD, FD_CLOEXEC);
+
+    args = parseCommand(c, &numArgs);
+
+    // point the standard input and output at the pipes so the
+    // child inherits them, runCommand() restores both afterwards
+    dup2(fromShell[0], 0);
+    dup2(toShell[1], 1);
+    close(fromShell[0]);
+    close(toShell[1]);
+
+    strcpy(coprocs[slot].name, name);
+    coprocs[slot].pid = shellBackground(args, v, stdOut);
+    coprocs[slot].fd[0] = toShell[0];
+    coprocs[slot].fd[1] = fromShell[1];
+
+    free(args);
+}
+
+/*************************************************
+Function: closeCoprocInput()
+Description: closes the shell's write end of a
+coprocess's input, ${NAME[1]} is not expanded after,
+if that is closed already and the coprocess has
+exited its output is closed and the name freed
+*************************************************/
+void closeCoprocInput(char *name)
+{
+    for (int i = 0; i < MAX_COPROC; i++)
+    {
+        if (coprocs[i].pid != 0 && !strcmp(coprocs[i].name, name))
+        {
+            if (coprocs[i].fd[1] != -1)
+            {
+                close(coprocs[i].fd[1]);
+                coprocs[i].fd[1] = -1;
+            }
+            else if (coprocs[i].exited)
+            {
+                freeCoproc(&coprocs[i]);
+            }
+            return;
+        }
+    }
+
+    printf("coproc: no such coprocess: %s\n", name);
+    fflush(stdout);
+}
+
+/*************************************************
+Function: closeCoproc()
+Description: closes the shell's write end once a
+coprocess has been reaped, its output is kept for
+reading until coproc -c NAME
+*************************************************/
+void closeCoproc(int pid)
+{
+    for (int i = 0; i < MAX_COPROC; i++)
+    {
+        if (coprocs[i].pid == pid && !coprocs[i].exited)
+        {
+            if (coprocs[i].fd[1] != -1)
+            {
+                close(coprocs[i].fd[1]);
+                coprocs[i].fd[1] = -1;
+            }
+            coprocs[i].exited = 1;
+            return;
+        }
+    }
+}
+
+/*************************************************
+Function: expandCoproc()
+Description: replaces each ${NAME[0]} and ${NAME[1]}
+in an argument with the matching coprocess fd,
+returns the argument untouched if there is nothing
+to expand, otherwise a newly allocated string
+*************************************************/
+char *expandCoproc(char *arg)
+{
+    char *search = arg;
+    char *start;
+
+    while ((start = strstr(search, "${")) != NULL)
+    {
+        char *end = strchr(start, '}');
+        int len;
+        int index;
+        int fd = -1;
+
+        if (end == NULL)
+        {
+            break;
+        }
+
+        // the text between the braces must look like NAME[0] or NAME[1]
+        len = end - start - 2;
+        if (len < 4 || end[-3] != '[' || end[-1] != ']' ||
+            (end[-2] != '0' && end[-2] != '1'))
+        {
+            search = start + 2;
+            continue;
+        }
+
+        index = end[-2] - '0';
+        len -= 3;
+
+        for (int i = 0; i < MAX_COPROC; i++)
+        {
+            if (coprocs[i].pid != 0 && !strncmp(coprocs[i].name, start + 2, len) &&
+                coprocs[i].name[len] == '\0')
+            {
+                fd = coprocs[i].fd[index];
+                break;
+            }
+        }
+
+        if (fd == -1) // unknown coprocess, leave it as written
+        {
+            search = start + 2;
+            continue;
+        }
+
+        // build prefix + fd + suffix in a new string
+        char fdStr[12];
+        int prefix = start - arg;
+        sprintf(fdStr, "%d", fd);
+
+        char *expanded = malloc(prefix + strlen(fdStr) + strlen(end + 1) + 1);
+        memcpy(expanded, arg, prefix);
+        strcpy(expanded + prefix, fdStr);
+        strcat(expanded, end + 1);
+
+        arg = expanded;
+        search = arg + prefix + strlen(fdStr);
+    }
+
+    return arg;
+}
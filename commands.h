@@ -1,23 +1,52 @@
 #ifndef COMMANDS_INCLUDED
 #define COMMANDS_INCLUDED
 
+#include <signal.h>
+
 #include "process.h"
 
+// state that belongs to one shell, either the interactive
+// one or a single client of the server, the status of the
+// last foreground command, whether & is honoured and the
+// background jobs, a served session only notes exit so
+// the server can still reply
+typedef struct Session
+{
+    int status;
+    int allowBackground;
+    BackArr *jobs;
+    int served;
+    int exited;
+} Session;
+
+Session *newSession();
+void deleteSession(Session *);
+
 void catchSIGINT(int signo);
 void catchSIGTSTP(int);
+void catchSIGCHLD(int, siginfo_t *, void *);
+int startChild(char **, int);
 int shellForeground(char **);
-void shellBackground(char **, BackArr *, int);
+int shellBackground(char **, BackArr *, int);
 void promptUser(BackArr *);
-int runCommand(char *, int, BackArr *);
+int runCommand(char *, Session *);
+void killJobs(BackArr *);
 void exitCustom(BackArr *);
+int exitCode(int);
 void cdCustom(char *);
 char *trimWhiteSpace(char *);
 void statusCustom(int);
 char **parseCommand(char *, int *);
 int checkState(BackArr *);
+void reapJobs();
+void startScheduled();
 char *getPath();
 int redirectOutput(char **, int);
 int redirectInput(char **, int);
 int backgroundRedirect(int, int);
+void coprocCustom(char *, BackArr *, int);
+void closeCoprocInput(char *);
+void closeCoproc(int);
+char *expandCoproc(char *);
 
 #endif
@@ -0,0 +1,1128 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "commands.h"
+#include "jobs.h"
+#include "spawn.h"
+#include "timer.h"
+
+#define JOB_RING 65536    // bytes of output kept per job
+#define MAX_DONE_JOBS 16  // finished jobs kept until their output is read
+#define JOB_READ 4096
+#define INPUT_BUF 4096
+#define MAX_FINISHED 64   // outcomes remembered for after
+#define EXIT_POLL_MS 100  // how often to reap without pidfds
+
+enum
+{
+    JOB_WAITING, // queued by after, not started yet
+    JOB_RUNNING,
+    JOB_DONE     // reaped, kept until its output is read
+};
+
+// a job that another one was queued after
+struct Dep
+{
+    int id;
+    int done;
+};
+
+// a background job, jobs with captured output stay in
+// the list after they are reaped until it has been read
+struct Job
+{
+    int id;
+    int pid;     // 0 while waiting
+    int state;
+    int status;
+    char *command;
+    int outFd;   // read end of the capture pipe, -1 when closed
+    char *ring;  // last JOB_RING bytes of output, NULL if not captured
+    size_t head; // next byte of the ring to write
+    size_t used;
+    int pidFd;     // readable once the job exits, -1 if unavailable
+    int scheduled; // started by after, counts against the cap
+    char *line;    // command line a waiting job will run
+    struct Dep *deps;
+    int numDeps;
+    struct Job *next;
+};
+
+// outcome of a job that has left the list, so after
+// can still name a job that was already reaped
+struct Finished
+{
+    int id;
+    int pid;
+    int status;
+};
+
+int captureOutput = 0; // set by --capture
+struct Job *jobList = NULL;
+int nextJobId = 1; // only starts over once the list is empty
+
+struct Finished finished[MAX_FINISHED];
+int finishedNext = 0;
+int scheduleCap = 0; // jobs started by after running at once, 0 is no limit
+int adoptId = 0;     // waiting job the next addJob() starts
+struct Job *streamed = NULL; // job followed by jobs -O, its output is echoed
+
+// bytes read by readInput() past the end of the last line
+char inputBuf[INPUT_BUF];
+int inputStart = 0;
+int inputEnd = 0;
+
+/*************************************************
+Function: findJob()
+Description: finds a running job by pid, finished
+jobs kept for their output are skipped as the pid
+may already belong to a new job
+*************************************************/
+static struct Job *findJob(int pid)
+{
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        if (j->pid == pid && j->state == JOB_RUNNING)
+        {
+            return j;
+        }
+    }
+    return NULL;
+}
+
+/*************************************************
+Function: findJobId()
+Description: finds a job by job number
+*************************************************/
+static struct Job *findJobId(int id)
+{
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        if (j->id == id)
+        {
+            return j;
+        }
+    }
+    return NULL;
+}
+
+/*************************************************
+Function: parseJob()
+Description: finds a job from %n, its job number,
+or a plain pid
+*************************************************/
+static struct Job *parseJob(const char *spec)
+{
+    if (spec == NULL)
+    {
+        return NULL;
+    }
+
+    if (*spec == '%')
+    {
+        return findJobId(atoi(spec + 1));
+    }
+
+    int pid = atoi(spec);
+    struct Job *job = findJob(pid);
+    struct Job *done = NULL;
+
+    // otherwise the newest finished job with that pid
+    for (struct Job *j = jobList; job == NULL && j != NULL; j = j->next)
+    {
+        if (j->pid == pid && j->state == JOB_DONE)
+        {
+            done = j;
+        }
+    }
+
+    return job != NULL ? job : done;
+}
+
+/*************************************************
+Function: removeJob()
+Description: unlinks a job and frees its command,
+capture pipe and ring
+*************************************************/
+static void removeJob(struct Job *job)
+{
+    struct Job **link = &jobList;
+
+    while (*link != job)
+    {
+        link = &(*link)->next;
+    }
+    *link = job->next;
+
+    if (job == streamed)
+    {
+        streamed = NULL;
+    }
+    if (job->outFd != -1)
+    {
+        close(job->outFd);
+    }
+    if (job->pidFd != -1)
+    {
+        close(job->pidFd);
+    }
+    free(job->ring);
+    free(job->command);
+    free(job->line);
+    free(job->deps);
+    free(job);
+}
+
+/*************************************************
+Function: newJob()
+Description: appends an empty job to the list with
+the next job number, numbers are not reused until
+the list has emptied
+*************************************************/
+static struct Job *newJob()
+{
+    struct Job *job = malloc(sizeof(struct Job));
+    struct Job **link = &jobList;
+
+    // numbering starts over, so the numbers remembered for
+    // after no longer name anything, only their pids do
+    if (jobList == NULL)
+    {
+        nextJobId = 1;
+        for (int i = 0; i < MAX_FINISHED; i++)
+        {
+            finished[i].id = 0;
+        }
+    }
+
+    while (*link != NULL)
+    {
+        link = &(*link)->next;
+    }
+
+    memset(job, 0, sizeof(struct Job));
+    job->id = nextJobId++;
+    job->outFd = -1;
+    job->pidFd = -1;
+    *link = job;
+
+    return job;
+}
+
+/*************************************************
+Function: addJob()
+Description: adds a background job to the end of
+the list and returns its job number, a job queued
+by after that is being started is reused instead
+*************************************************/
+int addJob(int pid, char **args)
+{
+    struct Job *job = adoptId ? findJobId(adoptId) : NULL;
+    size_t len = 1;
+
+    adoptId = 0;
+    if (job == NULL)
+    {
+        job = newJob();
+    }
+
+    for (int i = 0; args[i] != NULL; i++)
+    {
+        len += strlen(args[i]) + 1;
+    }
+
+    free(job->command);
+    job->command = malloc(len);
+    job->command[0] = '\0';
+    for (int i = 0; args[i] != NULL; i++)
+    {
+        if (i > 0)
+        {
+            strcat(job->command, " ");
+        }
+        strcat(job->command, args[i]);
+    }
+
+    job->pid = pid;
+    job->state = JOB_RUNNING;
+
+    // lets the event loop notice the exit while it is idle, the
+    // exit of a helper child is reported on the helper's socket
+#ifdef SYS_pidfd_open
+    if (!isHelperChild(pid))
+    {
+        job->pidFd = syscall(SYS_pidfd_open, pid, 0);
+    }
+#endif
+
+    return job->id;
+}
+
+/*************************************************
+Function: setJobOutput()
+Description: attaches the non-blocking read end of
+a capture pipe to the job and allocates its ring
+*************************************************/
+void setJobOutput(int pid, int fd)
+{
+    struct Job *job = findJob(pid);
+
+    if (job == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    job->outFd = fd;
+    job->ring = malloc(JOB_RING);
+}
+
+/*************************************************
+Function: appendRing()
+Description: copies output into the ring, the oldest
+bytes are overwritten once it is full
+*************************************************/
+static void appendRing(struct Job *job, const char *buf, size_t n)
+{
+    // only the last JOB_RING bytes can survive
+    if (n > JOB_RING)
+    {
+        buf += n - JOB_RING;
+        n = JOB_RING;
+    }
+
+    size_t first = JOB_RING - job->head;
+    if (first > n)
+    {
+        first = n;
+    }
+
+    memcpy(job->ring + job->head, buf, first);
+    memcpy(job->ring, buf + first, n - first);
+
+    job->head = (job->head + n) % JOB_RING;
+    job->used = job->used + n > JOB_RING ? JOB_RING : job->used + n;
+}
+
+/*************************************************
+Function: drainJob()
+Description: reads whatever is waiting on the job's
+capture pipe without blocking, closes the pipe at
+end of file
+*************************************************/
+static void drainJob(struct Job *job)
+{
+    char buf[JOB_READ];
+    ssize_t n;
+
+    if (job->outFd == -1)
+    {
+        return;
+    }
+
+    while ((n = read(job->outFd, buf, sizeof(buf))) != 0)
+    {
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                return;
+            }
+            break;
+        }
+        appendRing(job, buf, n);
+        if (job == streamed)
+        {
+            write(STDOUT_FILENO, buf, n);
+        }
+    }
+
+    close(job->outFd);
+    job->outFd = -1;
+}
+
+/*************************************************
+Function: drainJobs()
+Description: drains the capture pipe of every job
+*************************************************/
+void drainJobs()
+{
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        drainJob(j);
+    }
+}
+
+/*************************************************
+Function: hasWaiting()
+Description: returns 1 if any job is queued by after
+*************************************************/
+static int hasWaiting()
+{
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        if (j->state == JOB_WAITING)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*************************************************
+Function: pollJobs()
+Description: polls the capture pipes and the timer
+of timeout together with one extra descriptor,
+drains the pipes that are ready, fires deadlines
+that are due and returns 1 if the extra one is
+ready, -1 if a signal interrupted the wait and 0
+otherwise, a timeout of -1 waits forever, while jobs
+are queued by after the exits of running jobs are
+watched too so they are reaped straight away, the
+socket of the spawn helper is watched for the exits
+of its children
+*************************************************/
+static int pollJobs(int fd, int timeout)
+{
+    int watchExits = hasWaiting();
+    int exited = 0;
+    int num = 3;
+
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        num += j->outFd != -1;
+        num += watchExits && j->state == JOB_RUNNING;
+    }
+
+    struct pollfd fds[num];
+    struct Job *owners[num];
+
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = hasDeadlines() ? timerFd() : -1;
+    fds[1].events = POLLIN;
+    fds[2].fd = spawnFd();
+    fds[2].events = POLLIN;
+    num = 3;
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        if (j->outFd != -1)
+        {
+            fds[num].fd = j->outFd;
+            fds[num].events = POLLIN;
+            owners[num++] = j;
+        }
+
+        if (watchExits && j->state == JOB_RUNNING && !isHelperChild(j->pid))
+        {
+            // without a pidfd fall back to reaping on a timer
+            if (j->pidFd == -1 && (timeout == -1 || timeout > EXIT_POLL_MS))
+            {
+                timeout = EXIT_POLL_MS;
+            }
+            fds[num].fd = j->pidFd;
+            fds[num].events = POLLIN;
+            owners[num++] = NULL;
+        }
+    }
+
+    int ready = poll(fds, num, timeout);
+
+    if (ready > 0 && fds[1].revents)
+    {
+        fireDeadlines();
+    }
+
+    // a child of the helper exited, its pidfd is readable
+    // before the reply arrives so only the reply is watched
+    if (ready > 0 && fds[2].revents)
+    {
+        readSpawnReplies();
+        exited = 1;
+    }
+
+    for (int i = 3; ready > 0 && i < num; i++)
+    {
+        if (fds[i].revents == 0)
+        {
+            continue;
+        }
+
+        if (owners[i] != NULL)
+        {
+            drainJob(owners[i]);
+        }
+        else
+        {
+            exited = 1;
+        }
+    }
+
+    // reaping may free jobs, so only after the loop
+    if (watchExits && (exited || ready == 0))
+    {
+        reapJobs();
+    }
+
+    if (ready == -1)
+    {
+        return errno == EINTR ? -1 : 0;
+    }
+    return ready > 0 && fds[0].revents != 0;
+}
+
+/*************************************************
+Function: hasCaptures()
+Description: returns 1 if any capture pipe is open
+*************************************************/
+static int hasCaptures()
+{
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        if (j->outFd != -1)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*************************************************
+Function: waitInput()
+Description: blocks until the descriptor is ready
+to read, draining capture pipes in the meantime so
+background jobs never stall on a full pipe, firing
+the deadlines of timed jobs and starting jobs
+queued by after
+*************************************************/
+void waitInput(int fd)
+{
+    while (hasCaptures() || hasDeadlines() || hasWaiting())
+    {
+        if (pollJobs(fd, -1) == 1)
+        {
+            return;
+        }
+    }
+}
+
+/*************************************************
+Function: waitForeground()
+Description: waits for a foreground child to exit
+or be killed, while capture pipes are open, a
+deadline is due or jobs are queued it waits on a
+pidfd for the child alongside them
+*************************************************/
+int waitForeground(int pid, int *status)
+{
+    int pidfd = -1;
+    int result;
+
+    if (!hasCaptures() && !hasDeadlines() && !hasWaiting())
+    {
+        do
+        {
+            result = waitChild(pid, status, WUNTRACED);
+        } while (result != -1 && !WIFEXITED(*status) && !WIFSIGNALED(*status));
+        return result;
+    }
+
+    // a child of the helper is collected once the helper's
+    // reply arrives, which pollJobs() watches for
+    int helper = isHelperChild(pid);
+
+#ifdef SYS_pidfd_open
+    if (!helper)
+    {
+        pidfd = syscall(SYS_pidfd_open, pid, 0);
+    }
+#endif
+
+    while ((result = waitChild(pid, status, WNOHANG)) == 0)
+    {
+        // without a pidfd fall back to checking every 10ms
+        pollJobs(pidfd, pidfd == -1 && !helper ? 10 : -1);
+    }
+
+    if (pidfd != -1)
+    {
+        close(pidfd);
+    }
+
+    return result;
+}
+
+/*************************************************
+Function: readInput()
+Description: reads one line from the descriptor like
+getline(), buffering what it reads itself so that
+waitInput() is only called when no whole line is
+left, returns the length or -1 at end of file
+*************************************************/
+int readInput(int fd, char **line, size_t *size)
+{
+    size_t len = 0;
+    ssize_t n;
+
+    while (1)
+    {
+        while (inputStart < inputEnd)
+        {
+            if (len + 2 > *size)
+            {
+                *size = *size ? *size * 2 : 256;
+                *line = realloc(*line, *size);
+            }
+
+            char ch = inputBuf[inputStart++];
+            (*line)[len++] = ch;
+
+            if (ch == '\n')
+            {
+                (*line)[len] = '\0';
+                return len;
+            }
+        }
+
+        waitInput(fd);
+
+        n = read(fd, inputBuf, sizeof(inputBuf));
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            if (len == 0)
+            {
+                return -1;
+            }
+            (*line)[len] = '\0'; // last line had no newline
+            return len;
+        }
+
+        inputStart = 0;
+        inputEnd = n;
+    }
+}
+
+/*************************************************
+Function: recordFinished()
+Description: remembers how a job ended once it has
+left the list
+*************************************************/
+static void recordFinished(int id, int pid, int status)
+{
+    finished[finishedNext].id = id;
+    finished[finishedNext].pid = pid;
+    finished[finishedNext].status = status;
+    finishedNext = (finishedNext + 1) % MAX_FINISHED;
+}
+
+/*************************************************
+Function: resolveDependents()
+Description: marks a finished job as done for the
+jobs queued after it, if it failed they are skipped
+and so are the jobs queued after them in turn
+*************************************************/
+static void resolveDependents(int id, int status)
+{
+    int ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    struct Job *j = jobList;
+
+    while (j != NULL)
+    {
+        struct Job *next = j->next;
+
+        for (int i = 0; j->state == JOB_WAITING && i < j->numDeps; i++)
+        {
+            if (j->deps[i].id != id || j->deps[i].done)
+            {
+                continue;
+            }
+
+            if (ok)
+            {
+                j->deps[i].done = 1;
+                continue;
+            }
+
+            int skipped = j->id;
+            printf("[%d] skipped, %%%d failed: %s\n", skipped, id, j->command);
+            fflush(stdout);
+            recordFinished(skipped, 0, 1 << 8);
+            removeJob(j);
+            resolveDependents(skipped, 1 << 8);
+
+            // the cascade may have freed any job, start over
+            next = jobList;
+            break;
+        }
+
+        j = next;
+    }
+}
+
+/*************************************************
+Function: finishJob()
+Description: called once a job has been reaped,
+collects the rest of its output and frees it unless
+there is output left to read, then releases or
+skips the jobs queued after it
+*************************************************/
+void finishJob(int pid, int status)
+{
+    struct Job *job = findJob(pid);
+    int done = 0;
+
+    if (job == NULL)
+    {
+        return;
+    }
+
+    int id = job->id;
+    recordFinished(id, pid, status);
+
+    if (job->outFd != -1)
+    {
+        drainJob(job);
+        close(job->outFd); // anything still writing is a grandchild
+        job->outFd = -1;
+    }
+
+    if (job->used == 0)
+    {
+        removeJob(job);
+        resolveDependents(id, status);
+        return;
+    }
+
+    if (job->pidFd != -1)
+    {
+        close(job->pidFd);
+        job->pidFd = -1;
+    }
+    job->state = JOB_DONE;
+    job->status = status;
+
+    // bound the memory held by unread finished jobs
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        done += j->state == JOB_DONE;
+    }
+
+    for (struct Job *j = jobList; j != NULL && done > MAX_DONE_JOBS;)
+    {
+        struct Job *next = j->next;
+        if (j->state == JOB_DONE)
+        {
+            removeJob(j);
+            done--;
+        }
+        j = next;
+    }
+
+    resolveDependents(id, status);
+}
+
+/*************************************************
+Function: nextReadyJob()
+Description: returns the command line of the first
+queued job whose dependencies have all succeeded,
+ready to run in the background, or NULL if none is
+ready or the cap of after -j is reached, the next
+addJob() takes the job over
+*************************************************/
+char *nextReadyJob()
+{
+    int running = 0;
+
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        running += j->scheduled && j->state == JOB_RUNNING;
+    }
+
+    if (scheduleCap > 0 && running >= scheduleCap)
+    {
+        return NULL;
+    }
+
+    for (struct Job *j = jobList; j != NULL; j = j->next)
+    {
+        int ready = j->state == JOB_WAITING;
+
+        for (int i = 0; ready && i < j->numDeps; i++)
+        {
+            ready = j->deps[i].done;
+        }
+
+        if (ready)
+        {
+            char *line = malloc(strlen(j->line) + 3);
+            sprintf(line, "%s &", j->line);
+            j->scheduled = 1;
+            adoptId = j->id;
+            return line;
+        }
+    }
+
+    return NULL;
+}
+
+/*************************************************
+Function: endAdopt()
+Description: called after running the line from
+nextReadyJob(), if it started no job, like a built
+in, the queued job counts as having succeeded
+*************************************************/
+void endAdopt()
+{
+    struct Job *job = adoptId ? findJobId(adoptId) : NULL;
+
+    adoptId = 0;
+    if (job != NULL && job->state == JOB_WAITING)
+    {
+        int id = job->id;
+        recordFinished(id, 0, 0);
+        removeJob(job);
+        resolveDependents(id, 0);
+    }
+}
+
+/*************************************************
+Function: findDep()
+Description: resolves %n or a pid named by after,
+returns the job number with its state in done, 1
+if it succeeded already, -1 if it failed and 0 if
+it is still to finish, or 0 if it is not known
+*************************************************/
+static int findDep(const char *spec, int *done)
+{
+    struct Job *job = parseJob(spec);
+    int id = *spec == '%' ? atoi(spec + 1) : 0;
+    int pid = *spec == '%' ? 0 : atoi(spec);
+    int status;
+
+    if (job != NULL)
+    {
+        *done = 0;
+        if (job->state != JOB_DONE)
+        {
+            return job->id;
+        }
+        status = job->status;
+        id = job->id;
+    }
+    else
+    {
+        // newest outcome first, ids can be reused
+        int i;
+        for (i = 1; i <= MAX_FINISHED; i++)
+        {
+            struct Finished *f = &finished[(finishedNext - i + MAX_FINISHED) % MAX_FINISHED];
+            if ((id > 0 && f->id == id) || (pid > 0 && f->pid == pid))
+            {
+                break;
+            }
+        }
+        if (i > MAX_FINISHED || (id <= 0 && pid <= 0))
+        {
+            return 0;
+        }
+        struct Finished *f = &finished[(finishedNext - i + MAX_FINISHED) % MAX_FINISHED];
+        status = f->status;
+        id = f->id;
+    }
+
+    *done = WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 1 : -1;
+    return id;
+}
+
+/*************************************************
+Function: afterCustom()
+Description: built-in after function, queues a
+command to run in the background once the jobs it
+names, as %n or pid, have all exited successfully,
+-j N caps how many queued jobs run at once
+*************************************************/
+void afterCustom(char *c)
+{
+    int size = strlen(c);
+    struct Dep deps[size];
+    int numDeps = 0;
+    int capSet = 0;
+
+    c += 5;
+    while (1)
+    {
+        while (*c == ' ')
+        {
+            c++;
+        }
+
+        char *end = c;
+        while (*end != '\0' && *end != ' ')
+        {
+            end++;
+        }
+
+        if (end - c == 2 && !strncmp(c, "-j", 2))
+        {
+            c = end;
+            while (*c == ' ')
+            {
+                c++;
+            }
+            if (!isdigit((unsigned char)*c))
+            {
+                printf("after: -j needs a number\n");
+                fflush(stdout);
+                return;
+            }
+            scheduleCap = strtol(c, &c, 10);
+            capSet = 1;
+            continue;
+        }
+
+        if (*c != '%' && !isdigit((unsigned char)*c))
+        {
+            break;
+        }
+
+        char spec[end - c + 1];
+        int done;
+        memcpy(spec, c, end - c);
+        spec[end - c] = '\0';
+
+        int id = findDep(spec, &done);
+        if (id == 0)
+        {
+            printf("after: %s: no such job\n", spec);
+            fflush(stdout);
+            return;
+        }
+        if (done == -1)
+        {
+            printf("after: %s failed, not queued\n", spec);
+            fflush(stdout);
+            return;
+        }
+        if (done == 0)
+        {
+            deps[numDeps].id = id;
+            deps[numDeps++].done = 0;
+        }
+        c = end;
+    }
+
+    if (*c == '\0')
+    {
+        if (!capSet)
+        {
+            printf("after: usage: after [-j N] [%%n|pid ...] command\n");
+            fflush(stdout);
+        }
+        return;
+    }
+
+    // a trailing & is implied, the job always runs in the background
+    size = strlen(c);
+    while (size > 0 && (c[size - 1] == '&' || c[size - 1] == ' '))
+    {
+        c[--size] = '\0';
+    }
+
+    struct Job *job = newJob();
+    job->state = JOB_WAITING;
+    job->line = strdup(c);
+    job->command = strdup(c);
+    job->numDeps = numDeps;
+    job->deps = malloc(sizeof(struct Dep) * (numDeps + 1));
+    memcpy(job->deps, deps, sizeof(struct Dep) * numDeps);
+
+    printf("[%d] queued\n", job->id);
+    fflush(stdout);
+}
+
+/*************************************************
+Function: writeRing()
+Description: writes the ring to standard output,
+oldest byte first
+*************************************************/
+static void writeRing(struct Job *job)
+{
+    fflush(stdout);
+
+    if (job->used == JOB_RING)
+    {
+        write(STDOUT_FILENO, job->ring + job->head, JOB_RING - job->head);
+    }
+    write(STDOUT_FILENO, job->ring + (job->used == JOB_RING ? 0 : job->head - job->used),
+          job->used == JOB_RING ? job->head : job->used);
+}
+
+/*************************************************
+Function: streamJob()
+Description: writes the ring and then follows the
+capture pipe until end of file or an interrupt,
+output read here is kept in the ring too, the rest
+of the event loop keeps running meanwhile, returns
+the job or NULL if it was freed while it was followed
+*************************************************/
+static struct Job *streamJob(struct Job *job)
+{
+    sigset_t mask;
+
+    writeRing(job);
+    streamed = job;
+
+    // only ^C should stop the stream, not a child exiting
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    // drainJob() echoes the followed job's output, the other
+    // pipes, deadlines and queued jobs are served as usual
+    while (streamed != NULL && streamed->outFd != -1)
+    {
+        if (pollJobs(-1, -1) == -1)
+        {
+            break; // interrupted with ^C
+        }
+    }
+
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+    job = streamed;
+    streamed = NULL;
+    return job;
+}
+
+/*************************************************
+Function: printGraph()
+Description: prints every job with its state and
+each job it was queued after, marked ok once that
+one has succeeded
+*************************************************/
+static void printGraph()
+{
+    if (scheduleCap > 0)
+    {
+        printf("cap %d\n", scheduleCap);
+    }
+
+    for (struct Job *job = jobList; job != NULL; job = job->next)
+    {
+        const char *state = job->state == JOB_WAITING ? "waiting" : job->state == JOB_RUNNING ? "running" : "done";
+
+        printf("[%d] %s %s\n", job->id, state, job->command);
+        for (int i = 0; i < job->numDeps; i++)
+        {
+            struct Job *dep = findJobId(job->deps[i].id);
+            printf("  <- %%%d %s\n", job->deps[i].id,
+                   job->deps[i].done ? "ok" : dep != NULL && dep->state == JOB_WAITING ? "waiting" : "running");
+        }
+    }
+    fflush(stdout);
+}
+
+/*************************************************
+Function: jobsCustom()
+Description: built-in jobs function, with no options
+lists the jobs, -o %n prints the captured output of
+a job and -O %n follows it, the output of a finished
+job is freed once it has been printed, --graph shows
+the jobs queued by after with what they wait for
+*************************************************/
+void jobsCustom(char *c)
+{
+    char *option = strtok(c + 4, " ");
+    char *spec = strtok(NULL, " ");
+    struct Job *job;
+
+    drainJobs();
+
+    if (option == NULL)
+    {
+        for (job = jobList; job != NULL; job = job->next)
+        {
+            if (job->state == JOB_WAITING)
+            {
+                printf("[%d] waiting %s\n", job->id, job->command);
+            }
+            else if (job->state == JOB_RUNNING)
+            {
+                printf("[%d] %d running %s\n", job->id, job->pid, job->command);
+            }
+            else if (WIFEXITED(job->status))
+            {
+                printf("[%d] %d exit value %d %s\n", job->id, job->pid, WEXITSTATUS(job->status), job->command);
+            }
+            else
+            {
+                printf("[%d] %d terminated by signal %d %s\n", job->id, job->pid, WTERMSIG(job->status), job->command);
+            }
+        }
+        fflush(stdout);
+        return;
+    }
+
+    if (!strcmp(option, "--graph"))
+    {
+        printGraph();
+        return;
+    }
+
+    if (strcmp(option, "-o") && strcmp(option, "-O"))
+    {
+        printf("jobs: usage: jobs [--graph] [-o|-O %%n]\n");
+        fflush(stdout);
+        return;
+    }
+
+    job = parseJob(spec);
+    if (job == NULL)
+    {
+        printf("jobs: no such job: %s\n", spec ? spec : "");
+        fflush(stdout);
+        return;
+    }
+
+    if (job->ring == NULL)
+    {
+        printf("jobs: output of %s was not captured\n", spec);
+        fflush(stdout);
+        return;
+    }
+
+    if (!strcmp(option, "-O"))
+    {
+        job = streamJob(job);
+    }
+    else
+    {
+        writeRing(job);
+    }
+
+    // output of a finished job has now been seen
+    if (job != NULL && job->state == JOB_DONE)
+    {
+        removeJob(job);
+    }
+}
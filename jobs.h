@@ -0,0 +1,18 @@
+#ifndef JOBS_INCLUDED
+#define JOBS_INCLUDED
+
+extern int captureOutput;
+
+int addJob(int, char **);
+void setJobOutput(int, int);
+void finishJob(int, int);
+void drainJobs();
+void waitInput(int);
+int readInput(int, char **, size_t *);
+int waitForeground(int, int *);
+void jobsCustom(char *);
+void afterCustom(char *);
+char *nextReadyJob();
+void endAdopt();
+
+#endif
@@ -118,14 +118,14 @@ void removeBackArr(BackArr *v, int pid)
         if (v->process[i] == pid)
         {
             found = 1; // sets found flag to 1
+            break;
         }
-        break;
     }
 
     if (found == 1) // if found
     {
         // remove value by shifting over each element
-        for (int j = i; j < v->size; j++)
+        for (int j = i; j < v->size - 1; j++)
         {
             v->process[j] = v->process[j + 1];
         }
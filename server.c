@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "commands.h"
+#include "jobs.h"
+#include "server.h"
+
+/*
+Protocol: a client connects to the socket and first sends
+one byte with its stdin, stdout and stderr attached as
+SCM_RIGHTS. Every line it writes after that is run as a
+command, and for every line the server writes back the
+status of the last foreground command as a decimal line,
+the exit value, 128 plus the terminating signal, or 124
+if it was stopped by timeout. exit is replied to like
+any other line before the session ends. Each
+connection is served by its own forked process, so the
+cwd, status and foreground-only flag are per client.
+*/
+
+/*************************************************
+Function: receiveFds()
+Description: reads the opening message of a client
+and stores the three descriptors it carries, returns
+-1 unless exactly three were passed, every other
+descriptor received is closed
+*************************************************/
+static int receiveFds(int sock, int *fds)
+{
+    char byte;
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = {&byte, 1};
+    struct msghdr msg = {0};
+    struct cmsghdr *cmsg;
+    int ok;
+    int num = 0;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) <= 0)
+    {
+        return -1;
+    }
+
+    // the padding of the control buffer has room for a
+    // fourth descriptor, so only the first three are kept
+    ok = !(msg.msg_flags & MSG_CTRUNC);
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            ok = 0;
+            continue;
+        }
+
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (num < 3)
+            {
+                fds[num] = fd;
+            }
+            else
+            {
+                close(fd);
+            }
+            num++;
+        }
+    }
+
+    if (!ok || num != 3)
+    {
+        for (int i = 0; i < num && i < 3; i++)
+        {
+            close(fds[i]);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************
+Function: runSession()
+Description: serves one client in its own process
+group, the client's descriptors become the standard
+input, output and error, and each line it sends is
+passed to runCommand() with a status reply
+*************************************************/
+static void runSession(int sock)
+{
+    int fds[3];
+    char *input = NULL;
+    size_t inputSize = 0;
+    char reply[16];
+    Session *s;
+
+    // exit kills the process group, keep that to this client
+    setpgid(0, 0);
+
+    if (receiveFds(sock, fds) == -1)
+    {
+        char *message = "smallsh: expected stdin, stdout and stderr\n";
+        send(sock, message, strlen(message), MSG_NOSIGNAL);
+        exit(1);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    s = newSession();
+    s->served = 1;
+
+    while (!s->exited && readInput(sock, &input, &inputSize) != -1)
+    {
+        checkState(s->jobs);
+
+        // do nothing when first char is # or blank
+        if (input[0] != '#' && input[0] != '\n')
+        {
+            runCommand(input, s);
+        }
+
+        // without SIGPIPE, a client that has gone away is
+        // noticed here and its jobs are still cleaned up
+        int len = sprintf(reply, "%d\n", exitCode(s->status));
+        if (send(sock, reply, len, MSG_NOSIGNAL) != len)
+        {
+            break;
+        }
+    }
+
+    // client hung up or ran exit, clean up its background jobs
+    exitCustom(s->jobs);
+}
+
+/*************************************************
+Function: serveSocket()
+Description: listens on a unix socket and forks a
+session process for every client that connects,
+finished sessions are reaped by the kernel
+*************************************************/
+int serveSocket(const char *path)
+{
+    struct sockaddr_un addr = {0};
+    int listener;
+    int client;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "smallsh: socket path too long: %s\n", path);
+        return 1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener == -1)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    // remove a socket left by an earlier server, but never
+    // anything else that happens to be at the path
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listener, SOMAXCONN) == -1)
+    {
+        perror("smallsh");
+        close(listener);
+        return 1;
+    }
+
+    // sessions are never waited for, so do not keep zombies
+    struct sigaction SIGCHLD_action = {{0}};
+    SIGCHLD_action.sa_handler = SIG_DFL;
+    SIGCHLD_action.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &SIGCHLD_action, NULL);
+
+    while (1)
+    {
+        client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client == -1)
+        {
+            if (errno != EINTR)
+            {
+                perror("accept");
+            }
+            continue;
+        }
+
+        switch (fork())
+        {
+        case -1:
+            perror("smallsh");
+            break;
+        case 0:
+            // the session waits for its own children
+            SIGCHLD_action.sa_sigaction = catchSIGCHLD;
+            sigfillset(&SIGCHLD_action.sa_mask);
+            SIGCHLD_action.sa_flags = SA_RESTART | SA_SIGINFO;
+            sigaction(SIGCHLD, &SIGCHLD_action, NULL);
+
+            close(listener);
+            runSession(client);
+            exit(0);
+        default:
+            break;
+        }
+
+        close(client);
+    }
+
+    return 0;
+}
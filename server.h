@@ -0,0 +1,6 @@
+#ifndef SERVER_INCLUDED
+#define SERVER_INCLUDED
+
+int serveSocket(const char *);
+
+#endif
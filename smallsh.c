@@ -6,12 +6,44 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
+#include <string.h>
 
 #include "commands.h"
+#include "jobs.h"
 #include "process.h"
+#include "server.h"
+#include "spawn.h"
 
 int main(int argc, char **argv)
 {
+    char *serve = NULL;
+    int spawnHelper = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--serve") && i + 1 < argc)
+        {
+            serve = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--spawn-helper"))
+        {
+            spawnHelper = 1;
+        }
+        else if (!strcmp(argv[i], "--capture"))
+        {
+            // keep the output of background jobs in memory
+            captureOutput = 1;
+        }
+    }
+
+    // fork the helper now while the shell is small, sessions
+    // of the server fork their own commands as one helper
+    // cannot be shared between them
+    if (spawnHelper && serve == NULL)
+    {
+        startSpawnHelper();
+    }
+
     // singal handler for SIGINT
     struct sigaction SIGINT_action = {{0}};
     SIGINT_action.sa_handler = catchSIGINT;
@@ -26,24 +58,45 @@ int main(int argc, char **argv)
     SIGTSTP_action.sa_flags = SA_RESTART;
     sigaction(SIGTSTP, &SIGTSTP_action, NULL);
 
-    int status = 0;
-    char *input = NULL;
+    // signal handler for SIGCHLD, records exit times for stats
+    struct sigaction SIGCHLD_action = {{0}};
+    SIGCHLD_action.sa_sigaction = catchSIGCHLD;
+    sigfillset(&SIGCHLD_action.sa_mask);
+    SIGCHLD_action.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigaction(SIGCHLD, &SIGCHLD_action, NULL);
+
+    // serve command lines over a unix socket instead
+    // of reading them from the terminal
+    if (serve != NULL)
+    {
+        return serveSocket(serve);
+    }
+
+    char *input = malloc(MAX_LEN);
     size_t inputSize = MAX_LEN;
 
-    BackArr *v;
-    v = newBackArr(4); // create a new back array
+    Session *s;
+    s = newSession(); // status, foreground-only flag and background array
 
     // start up the shell and continue forever, until
     // someone terminates it with the exit command
     do
     {
-        promptUser(v);
-        getline(&input, &inputSize, stdin);
+        promptUser(s->jobs);
+
+        // readInput() keeps job output drained and deadlines
+        // firing while it waits, at end of input the shell
+        // kills its own jobs and exits with the last status
+        if (readInput(STDIN_FILENO, &input, &inputSize) == -1)
+        {
+            killJobs(s->jobs);
+            exit(exitCode(s->status));
+        }
 
         // do nothing when first char is # or blank
         if (input[0] != '#' && input[0] != '\n')
         {
-            status = runCommand(input, status, v);
+            runCommand(input, s);
         }
     } while (1);
 
@@ -0,0 +1,563 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spawn.h"
+#include "stats.h"
+
+#define SPAWN_SOCKBUF (1 << 20)
+
+extern char **environ;
+
+enum
+{
+    REPLY_SPAWNED, // pid of the new child, or -1 and errno in status
+    REPLY_EXITED   // a child finished, status is from waitpid
+};
+
+struct SpawnReply
+{
+    int type;
+    int pid;
+    int status;
+    long long time; // when an exited child was reaped
+};
+
+// header of a spawn request, followed by the cwd, argv
+// and envp strings, each terminated by \0
+struct SpawnRequest
+{
+    int flags;
+    int argc;
+    int envc;
+};
+
+// a child started through the helper that the shell
+// has not collected yet
+struct HelperChild
+{
+    pid_t pid;
+    int done;
+    int status;
+};
+
+int spawnSock = -1; // shell's end of the socketpair, -1 when disabled
+struct HelperChild *helperChildren = NULL;
+int helperSize = 0;
+int helperCapacity = 0;
+
+/*************************************************
+Function: runHelperChild()
+Description: runs in the process forked by the
+helper, installs the shell's descriptors and cwd
+and then execs the command
+*************************************************/
+static void runHelperChild(struct SpawnRequest *req, char *strings, int *fds, sigset_t *mask)
+{
+    char *argv[req->argc + 1];
+    char *envp[req->envc + 1];
+    char *cwd = strings;
+    char *p = cwd + strlen(cwd) + 1;
+
+    for (int i = 0; i < req->argc; i++)
+    {
+        argv[i] = p;
+        p += strlen(p) + 1;
+    }
+    argv[req->argc] = NULL;
+
+    for (int i = 0; i < req->envc; i++)
+    {
+        envp[i] = p;
+        p += strlen(p) + 1;
+    }
+    envp[req->envc] = NULL;
+
+    // undo what the helper changed for itself
+    sigprocmask(SIG_UNBLOCK, mask, NULL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+
+    for (int i = 0; i < 3; i++)
+    {
+        dup2(fds[i], i);
+    }
+
+    if (chdir(cwd) == -1)
+    {
+        perror("smallsh");
+        fflush(stdout);
+        _exit(1);
+    }
+
+    if (req->flags & SPAWN_GROUP)
+    {
+        setpgid(0, 0);
+    }
+
+    environ = envp;
+    if (req->flags & SPAWN_SEARCH)
+    {
+        execvp(argv[0], argv);
+    }
+    else
+    {
+        execv(argv[0], argv);
+    }
+
+    perror("smallsh");
+    fflush(stdout);
+    _exit(1);
+}
+
+/*************************************************
+Function: serveSpawnRequest()
+Description: reads one request from the shell,
+forks the command and replies with its pid, returns
+0 when the shell has gone away
+*************************************************/
+static int serveSpawnRequest(int sock, sigset_t *mask)
+{
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct SpawnReply reply = {REPLY_SPAWNED, -1, 0, 0};
+    int execPipe[2];
+    char byte;
+    struct msghdr msg = {0};
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    int fds[3];
+    ssize_t n;
+
+    // sequenced packets, so peek at the size of the next one
+    n = recv(sock, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (n <= 0)
+    {
+        return 0;
+    }
+
+    char *buf = malloc(n + 1);
+    iov.iov_base = buf;
+    iov.iov_len = n;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (n < (ssize_t)sizeof(struct SpawnRequest) || cmsg == NULL ||
+        cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+    {
+        free(buf);
+        return n > 0;
+    }
+    buf[n] = '\0';
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    // closes when the child execs, so the shell can time it
+    if (pipe2(execPipe, O_CLOEXEC) == -1)
+    {
+        execPipe[0] = -1;
+    }
+
+    switch (reply.pid = fork())
+    {
+    case -1:
+        reply.status = errno;
+        break;
+    case 0:
+        runHelperChild((struct SpawnRequest *)buf, buf + sizeof(struct SpawnRequest), fds, mask);
+        break;
+    }
+
+    // set it here too so it holds before the shell can signal it
+    if (reply.pid > 0 && (((struct SpawnRequest *)buf)->flags & SPAWN_GROUP))
+    {
+        setpgid(reply.pid, reply.pid);
+    }
+
+    if (execPipe[0] != -1)
+    {
+        close(execPipe[1]);
+        if (reply.pid != -1)
+        {
+            while (read(execPipe[0], &byte, 1) == -1 && errno == EINTR)
+                ;
+        }
+        close(execPipe[0]);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        close(fds[i]);
+    }
+    free(buf);
+
+    send(sock, &reply, sizeof(reply), 0);
+    return 1;
+}
+
+/*************************************************
+Function: runSpawnHelper()
+Description: main loop of the helper, serves spawn
+requests and reports every child that finishes
+*************************************************/
+static void runSpawnHelper(int sock)
+{
+    struct pollfd fds[2];
+    sigset_t mask;
+
+    // signals from the terminal are for the shell and its children
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+    fds[1].fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    fds[1].events = POLLIN;
+
+    while (1)
+    {
+        if (poll(fds, 2, -1) == -1)
+        {
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            struct signalfd_siginfo info;
+            struct SpawnReply reply = {REPLY_EXITED, 0, 0, 0};
+
+            read(fds[1].fd, &info, sizeof(info));
+            while ((reply.pid = waitpid(-1, &reply.status, WNOHANG)) > 0)
+            {
+                reply.time = nowNanos();
+                send(sock, &reply, sizeof(reply), 0);
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP))
+        {
+            if (!serveSpawnRequest(sock, &mask))
+            {
+                _exit(0); // the shell has exited
+            }
+        }
+    }
+}
+
+/*************************************************
+Function: startSpawnHelper()
+Description: forks the spawn helper, meant to be
+called first thing in main() while the shell is
+still small, so that the cost of each later fork
+does not grow with the shell
+*************************************************/
+int startSpawnHelper()
+{
+    int sv[2];
+    int size = SPAWN_SOCKBUF;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+    {
+        perror("socketpair");
+        return -1;
+    }
+
+    // room for large environments in a single packet
+    for (int i = 0; i < 2; i++)
+    {
+        setsockopt(sv[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(sv[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    switch (fork())
+    {
+    case -1:
+        perror("smallsh");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    case 0:
+        close(sv[0]);
+        runSpawnHelper(sv[1]);
+        _exit(0);
+    }
+
+    close(sv[1]);
+    spawnSock = sv[0];
+    return 0;
+}
+
+/*************************************************
+Function: readHelperReply()
+Description: reads one reply from the helper and
+records exits, returns the reply type, or -1 if
+nothing was read
+*************************************************/
+static int readHelperReply(struct SpawnReply *reply, int nonBlock)
+{
+    ssize_t n = recv(spawnSock, reply, sizeof(*reply), nonBlock ? MSG_DONTWAIT : 0);
+
+    if (n != sizeof(*reply))
+    {
+        if (n >= 0)
+        {
+            errno = ECONNRESET; // the helper has exited
+        }
+        return -1;
+    }
+
+    if (reply->type == REPLY_EXITED)
+    {
+        for (int i = 0; i < helperSize; i++)
+        {
+            if (helperChildren[i].pid == reply->pid)
+            {
+                noteChildExit(reply->pid, reply->time);
+                helperChildren[i].done = 1;
+                helperChildren[i].status = reply->status;
+                break;
+            }
+        }
+    }
+
+    return reply->type;
+}
+
+/*************************************************
+Function: helperSpawn()
+Description: asks the helper to run the command
+with the shell's current stdin, stdout, stderr, cwd
+and environment, flags are SPAWN_SEARCH and
+SPAWN_GROUP, returns the child pid, or -1 if the helper is not
+running or could not take the request so the caller
+should fork itself
+*************************************************/
+int helperSpawn(char **args, int flags)
+{
+    char cwd[PATH_MAX];
+    struct SpawnRequest req = {flags, 0, 0};
+    struct SpawnReply reply;
+    size_t len = 0;
+
+    if (spawnSock == -1 || getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        return -1;
+    }
+
+    len += strlen(cwd) + 1;
+    for (; args[req.argc] != NULL; req.argc++)
+    {
+        len += strlen(args[req.argc]) + 1;
+    }
+    for (; environ[req.envc] != NULL; req.envc++)
+    {
+        len += strlen(environ[req.envc]) + 1;
+    }
+
+    // pack the header and the strings into one packet
+    char *buf = malloc(sizeof(req) + len);
+    char *p = buf + sizeof(req);
+    memcpy(buf, &req, sizeof(req));
+
+    p = stpcpy(p, cwd) + 1;
+    for (int i = 0; i < req.argc; i++)
+    {
+        p = stpcpy(p, args[i]) + 1;
+    }
+    for (int i = 0; i < req.envc; i++)
+    {
+        p = stpcpy(p, environ[i]) + 1;
+    }
+
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))] = {0};
+    struct iovec iov = {buf, sizeof(req) + len};
+    struct msghdr msg = {0};
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent = sendmsg(spawnSock, &msg, 0);
+    free(buf);
+
+    if (sent == -1)
+    {
+        if (errno != EMSGSIZE)
+        {
+            // helper is gone, stop using it
+            close(spawnSock);
+            spawnSock = -1;
+        }
+        return -1;
+    }
+
+    // exits of earlier children may arrive first
+    int type;
+    while ((type = readHelperReply(&reply, 0)) != REPLY_SPAWNED)
+    {
+        if (type == -1 && errno != EINTR)
+        {
+            close(spawnSock);
+            spawnSock = -1;
+            return -1;
+        }
+    }
+
+    if (reply.pid == -1)
+    {
+        errno = reply.status;
+        return -1;
+    }
+
+    if (helperSize == helperCapacity)
+    {
+        helperCapacity = helperCapacity ? helperCapacity * 2 : 8;
+        helperChildren = realloc(helperChildren, helperCapacity * sizeof(struct HelperChild));
+    }
+
+    helperChildren[helperSize].pid = reply.pid;
+    helperChildren[helperSize].done = 0;
+    helperChildren[helperSize].status = 0;
+    helperSize++;
+
+    return reply.pid;
+}
+
+/*************************************************
+Function: waitChild()
+Description: waitpid() for children of the shell
+and of the helper alike, only WNOHANG is honoured
+for children of the helper
+*************************************************/
+int waitChild(int pid, int *status, int options)
+{
+    struct SpawnReply reply;
+    int i;
+
+    for (i = 0; i < helperSize; i++)
+    {
+        if (helperChildren[i].pid == pid)
+        {
+            break;
+        }
+    }
+
+    if (i == helperSize)
+    {
+        return waitpid(pid, status, options);
+    }
+
+    while (!helperChildren[i].done)
+    {
+        if (readHelperReply(&reply, options & WNOHANG) == -1)
+        {
+            if ((options & WNOHANG) && errno == EAGAIN)
+            {
+                return 0;
+            }
+            if (errno != EINTR)
+            {
+                errno = ECHILD;
+                return -1;
+            }
+        }
+    }
+
+    *status = helperChildren[i].status;
+    helperChildren[i] = helperChildren[--helperSize];
+    return pid;
+}
+
+/*************************************************
+Function: isHelperChild()
+Description: returns 1 if the child was started by
+the helper and has not been collected yet
+*************************************************/
+int isHelperChild(int pid)
+{
+    for (int i = 0; i < helperSize; i++)
+    {
+        if (helperChildren[i].pid == pid)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*************************************************
+Function: helperChildExited()
+Description: returns 1 if the helper has reported
+that the child exited, replies already waiting are
+read first
+*************************************************/
+int helperChildExited(int pid)
+{
+    readSpawnReplies();
+
+    for (int i = 0; i < helperSize; i++)
+    {
+        if (helperChildren[i].pid == pid)
+        {
+            return helperChildren[i].done;
+        }
+    }
+    return 0;
+}
+
+/*************************************************
+Function: spawnFd()
+Description: the socket the helper reports exits
+on, -1 while no child of the helper is outstanding
+*************************************************/
+int spawnFd()
+{
+    return helperSize > 0 ? spawnSock : -1;
+}
+
+/*************************************************
+Function: readSpawnReplies()
+Description: records every reply already waiting
+on the socket without blocking, closes the socket
+if the helper has gone away
+*************************************************/
+void readSpawnReplies()
+{
+    struct SpawnReply reply;
+
+    while (spawnSock != -1 && readHelperReply(&reply, 1) != -1)
+    {
+    }
+
+    if (spawnSock != -1 && errno != EAGAIN && errno != EINTR)
+    {
+        close(spawnSock);
+        spawnSock = -1;
+    }
+}
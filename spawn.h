@@ -0,0 +1,16 @@
+#ifndef SPAWN_INCLUDED
+#define SPAWN_INCLUDED
+
+// flags for helperSpawn() and startChild()
+#define SPAWN_SEARCH 1 // look the command up with execvp
+#define SPAWN_GROUP 2  // run it in a new process group
+
+int startSpawnHelper();
+int helperSpawn(char **, int);
+int waitChild(int, int *, int);
+int isHelperChild(int);
+int helperChildExited(int);
+int spawnFd();
+void readSpawnReplies();
+
+#endif
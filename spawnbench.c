@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spawn.h"
+
+#define STEP_MB 128
+#define SPAWNS 200
+
+/*************************************************
+Function: nowMicros()
+Description: monotonic clock in microseconds
+*************************************************/
+static double nowMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*************************************************
+Function: residentMB()
+Description: resident set size of this process
+*************************************************/
+static long residentMB()
+{
+    long pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f != NULL)
+    {
+        fscanf(f, "%*s %ld", &pages);
+        fclose(f);
+    }
+
+    return pages * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+/*************************************************
+Function: directSpawn()
+Description: the shellForeground() path, fork the
+process itself, exec and wait
+*************************************************/
+static void directSpawn(char **args)
+{
+    int status;
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        execv(args[0], args);
+        _exit(1);
+    }
+    waitpid(pid, &status, 0);
+}
+
+/*************************************************
+Function: main()
+Description: grows the heap in steps and times the
+same command spawned with a direct fork and through
+the spawn helper forked at startup, usage is
+spawnbench [max MB]
+*************************************************/
+int main(int argc, char **argv)
+{
+    char *args[] = {"/bin/true", NULL};
+    int maxMB = argc > 1 ? atoi(argv[1]) : 1024;
+    int status;
+
+    if (startSpawnHelper() == -1)
+    {
+        return 1;
+    }
+
+    printf("%8s %14s %14s\n", "rss MB", "fork us", "helper us");
+
+    for (int mb = 0; mb <= maxMB; mb += STEP_MB)
+    {
+        // touch the new memory so it is really resident
+        if (mb > 0)
+        {
+            char *grow = malloc((size_t)STEP_MB * 1024 * 1024);
+            memset(grow, 1, (size_t)STEP_MB * 1024 * 1024);
+        }
+
+        double start = nowMicros();
+        for (int i = 0; i < SPAWNS; i++)
+        {
+            directSpawn(args);
+        }
+        double direct = (nowMicros() - start) / SPAWNS;
+
+        start = nowMicros();
+        for (int i = 0; i < SPAWNS; i++)
+        {
+            waitChild(helperSpawn(args, 0), &status, 0);
+        }
+        double helper = (nowMicros() - start) / SPAWNS;
+
+        printf("%8ld %14.1f %14.1f\n", residentMB(), direct, helper);
+        fflush(stdout);
+    }
+
+    return 0;
+}
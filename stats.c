@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+#define SUB_BITS 3 // 8 buckets per power of two, within 12.5%
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+#define EXIT_SLOTS 64
+
+// log bucketed histogram in the style of HdrHistogram,
+// values below SUB_BUCKETS are exact and every power of
+// two above is split into SUB_BUCKETS linear buckets
+struct Histogram
+{
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long min;
+    unsigned long long max;
+    unsigned long long buckets[NUM_BUCKETS];
+};
+
+// exit times of children, filled in by the SIGCHLD handler
+// and the spawn helper and read back when they are reaped
+struct ExitStamp
+{
+    int pid;
+    long long time;
+};
+
+const char *commandNames[NUM_COMMAND_STATS] = {
+    "exit", "cd", "status", "coproc", "jobs", "stats", "timeout", "after", "foreground", "background"};
+
+const char *histNames[NUM_HISTS] = {
+    "fork_exec", "foreground_wait", "reap_lag", "parse"};
+
+unsigned long long commandCounts[NUM_COMMAND_STATS];
+struct Histogram histograms[NUM_HISTS];
+int peakBackground = 0;
+
+struct ExitStamp exitStamps[EXIT_SLOTS];
+
+/*************************************************
+Function: nowNanos()
+Description: monotonic clock in nanoseconds, safe
+to call from a signal handler
+*************************************************/
+long long nowNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*************************************************
+Function: countCommand()
+Description: counts one run of a built in or an
+external command
+*************************************************/
+void countCommand(int which)
+{
+    commandCounts[which]++;
+}
+
+/*************************************************
+Function: bucketIndex()
+Description: maps a value to its histogram bucket
+*************************************************/
+static int bucketIndex(unsigned long long v)
+{
+    if (v < SUB_BUCKETS)
+    {
+        return v;
+    }
+
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + (int)((v >> shift) - SUB_BUCKETS);
+}
+
+/*************************************************
+Function: bucketValue()
+Description: middle of the range a bucket covers
+*************************************************/
+static unsigned long long bucketValue(int index)
+{
+    if (index < SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    int shift = index / SUB_BUCKETS - 1;
+    unsigned long long low = (unsigned long long)(index % SUB_BUCKETS + SUB_BUCKETS) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+/*************************************************
+Function: recordLatency()
+Description: adds a value in nanoseconds to one of
+the histograms
+*************************************************/
+void recordLatency(int which, long long ns)
+{
+    struct Histogram *h = &histograms[which];
+    unsigned long long v = ns < 0 ? 0 : ns;
+
+    if (h->count == 0 || v < h->min)
+    {
+        h->min = v;
+    }
+    if (v > h->max)
+    {
+        h->max = v;
+    }
+
+    h->count++;
+    h->sum += v;
+    h->buckets[bucketIndex(v)]++;
+}
+
+/*************************************************
+Function: percentile()
+Description: value at or below which p percent of
+the recorded values fall
+*************************************************/
+static unsigned long long percentile(struct Histogram *h, double p)
+{
+    unsigned long long rank = (unsigned long long)(h->count * p / 100.0 + 0.5);
+    unsigned long long seen = 0;
+
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+
+    for (int i = 0; i < NUM_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            unsigned long long v = bucketValue(i);
+            return v > h->max ? h->max : v < h->min ? h->min : v;
+        }
+    }
+
+    return h->max;
+}
+
+/*************************************************
+Function: noteBackgroundJobs()
+Description: tracks the most background jobs that
+were running at once
+*************************************************/
+void noteBackgroundJobs(int num)
+{
+    if (num > peakBackground)
+    {
+        peakBackground = num;
+    }
+}
+
+/*************************************************
+Function: noteChildExit()
+Description: records when a child exited, called
+from the SIGCHLD handler so it only stores values
+*************************************************/
+void noteChildExit(int pid, long long time)
+{
+    exitStamps[pid % EXIT_SLOTS].pid = pid;
+    exitStamps[pid % EXIT_SLOTS].time = time;
+}
+
+/*************************************************
+Function: childExitTime()
+Description: returns when a reaped child exited, 0
+if nothing is known, as when its SIGCHLD was merged
+with another one or its slot was reused by another
+child, so the sample is skipped rather than wrong
+*************************************************/
+long long childExitTime(int pid)
+{
+    struct ExitStamp *stamp = &exitStamps[pid % EXIT_SLOTS];
+
+    if (stamp->pid == pid)
+    {
+        stamp->pid = 0;
+        return stamp->time;
+    }
+
+    return 0;
+}
+
+/*************************************************
+Function: printStats()
+Description: prints the counters and a summary of
+each histogram in microseconds
+*************************************************/
+static void printStats()
+{
+    printf("commands:");
+    for (int i = 0; i < NUM_COMMAND_STATS; i++)
+    {
+        printf(" %s %llu", commandNames[i], commandCounts[i]);
+    }
+    printf("\nbackground peak: %d\n", peakBackground);
+
+    printf("%-16s %8s %10s %10s %10s %10s %10s\n", "latency us", "count", "mean", "p50", "p90", "p99", "max");
+    for (int i = 0; i < NUM_HISTS; i++)
+    {
+        struct Histogram *h = &histograms[i];
+
+        printf("%-16s %8llu", histNames[i], h->count);
+        if (h->count == 0)
+        {
+            printf("\n");
+            continue;
+        }
+
+        printf(" %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               h->sum / (double)h->count / 1000.0,
+               percentile(h, 50) / 1000.0,
+               percentile(h, 90) / 1000.0,
+               percentile(h, 99) / 1000.0,
+               h->max / 1000.0);
+    }
+}
+
+/*************************************************
+Function: printStatsJson()
+Description: prints the same values as one JSON
+object, latencies in nanoseconds
+*************************************************/
+static void printStatsJson()
+{
+    printf("{\"commands\":{");
+    for (int i = 0; i < NUM_COMMAND_STATS; i++)
+    {
+        printf("%s\"%s\":%llu", i ? "," : "", commandNames[i], commandCounts[i]);
+    }
+    printf("},\"background_peak\":%d,\"latency_ns\":{", peakBackground);
+
+    for (int i = 0; i < NUM_HISTS; i++)
+    {
+        struct Histogram *h = &histograms[i];
+
+        printf("%s\"%s\":{\"count\":%llu", i ? "," : "", histNames[i], h->count);
+        if (h->count > 0)
+        {
+            printf(",\"min\":%llu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu",
+                   h->min, h->sum / h->count, percentile(h, 50), percentile(h, 90),
+                   percentile(h, 99), h->max);
+        }
+        printf("}");
+    }
+    printf("}}\n");
+}
+
+/*************************************************
+Function: statsCustom()
+Description: built-in stats function, prints the
+counters and latencies, as JSON with --json, and
+clears them afterwards with --reset
+*************************************************/
+void statsCustom(char *c)
+{
+    int json = 0;
+    int reset = 0;
+
+    for (char *arg = strtok(c + 5, " "); arg != NULL; arg = strtok(NULL, " "))
+    {
+        if (!strcmp(arg, "--json"))
+        {
+            json = 1;
+        }
+        else if (!strcmp(arg, "--reset"))
+        {
+            reset = 1;
+        }
+        else
+        {
+            printf("stats: usage: stats [--json] [--reset]\n");
+            fflush(stdout);
+            return;
+        }
+    }
+
+    if (json)
+    {
+        printStatsJson();
+    }
+    else
+    {
+        printStats();
+    }
+    fflush(stdout);
+
+    if (reset)
+    {
+        memset(commandCounts, 0, sizeof(commandCounts));
+        memset(histograms, 0, sizeof(histograms));
+        peakBackground = 0;
+    }
+}
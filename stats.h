@@ -0,0 +1,38 @@
+#ifndef STATS_INCLUDED
+#define STATS_INCLUDED
+
+// commands counted by the stats built in
+enum
+{
+    STAT_EXIT,
+    STAT_CD,
+    STAT_STATUS,
+    STAT_COPROC,
+    STAT_JOBS,
+    STAT_STATS,
+    STAT_TIMEOUT,
+    STAT_AFTER,
+    STAT_FOREGROUND,
+    STAT_BACKGROUND,
+    NUM_COMMAND_STATS
+};
+
+// latencies kept as histograms, in nanoseconds
+enum
+{
+    HIST_FORK_EXEC,
+    HIST_FOREGROUND,
+    HIST_REAP_LAG,
+    HIST_PARSE,
+    NUM_HISTS
+};
+
+long long nowNanos();
+void countCommand(int);
+void recordLatency(int, long long);
+void noteBackgroundJobs(int);
+void noteChildExit(int, long long);
+long long childExitTime(int);
+void statsCustom(char *);
+
+#endif
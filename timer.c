@@ -0,0 +1,464 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <ctype.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "spawn.h"
+#include "stats.h"
+#include "timer.h"
+
+#define NEVER LLONG_MAX // when of a deadline that has fired for good
+
+// deadline of one timed command, kept in a min heap on
+// when, fired ones stay in the heap until the command
+// is reaped so its status can say it timed out
+struct Deadline
+{
+    long long when;
+    long long killAfter; // 0, or the delay before SIGKILL
+    int pid;
+    int sig;
+    int fired;
+};
+
+struct Deadline *deadlines = NULL;
+int deadlineSize = 0;
+int deadlineCapacity = 0;
+int deadlineFd = -1;
+
+// deadline for the next command started, set by timeout
+int pendingTimeout = 0;
+long long pendingDuration;
+long long pendingKillAfter;
+int pendingSignal;
+
+/*************************************************
+Function: swapDeadlines()
+Description: swaps two heap entries
+*************************************************/
+static void swapDeadlines(int a, int b)
+{
+    struct Deadline temp = deadlines[a];
+    deadlines[a] = deadlines[b];
+    deadlines[b] = temp;
+}
+
+/*************************************************
+Function: siftUp()
+Description: moves an entry towards the root until
+its parent is due no later than it
+*************************************************/
+static void siftUp(int i)
+{
+    while (i > 0 && deadlines[(i - 1) / 2].when > deadlines[i].when)
+    {
+        swapDeadlines(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/*************************************************
+Function: siftDown()
+Description: moves an entry away from the root
+until both children are due no earlier than it
+*************************************************/
+static void siftDown(int i)
+{
+    while (1)
+    {
+        int least = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < deadlineSize && deadlines[left].when < deadlines[least].when)
+        {
+            least = left;
+        }
+        if (right < deadlineSize && deadlines[right].when < deadlines[least].when)
+        {
+            least = right;
+        }
+        if (least == i)
+        {
+            return;
+        }
+
+        swapDeadlines(i, least);
+        i = least;
+    }
+}
+
+/*************************************************
+Function: armTimer()
+Description: points the timerfd at the earliest
+deadline, or disarms it when nothing is due
+*************************************************/
+static void armTimer()
+{
+    struct itimerspec spec = {{0, 0}, {0, 0}};
+
+    if (deadlineFd == -1)
+    {
+        return;
+    }
+
+    if (deadlineSize > 0 && deadlines[0].when != NEVER)
+    {
+        // an absolute time of zero would disarm it
+        long long when = deadlines[0].when > 0 ? deadlines[0].when : 1;
+        spec.it_value.tv_sec = when / 1000000000LL;
+        spec.it_value.tv_nsec = when % 1000000000LL;
+    }
+
+    timerfd_settime(deadlineFd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/*************************************************
+Function: parseDuration()
+Description: parses a duration such as 10, 1.5s,
+2m, 1h or 1d into nanoseconds, -1 if invalid
+*************************************************/
+static long long parseDuration(const char *text)
+{
+    char *end;
+    double value = strtod(text, &end);
+
+    if (end == text || value < 0)
+    {
+        return -1;
+    }
+
+    switch (*end)
+    {
+    case '\0':
+    case 's':
+        break;
+    case 'm':
+        value *= 60;
+        break;
+    case 'h':
+        value *= 60 * 60;
+        break;
+    case 'd':
+        value *= 24 * 60 * 60;
+        break;
+    default:
+        return -1;
+    }
+
+    if (*end != '\0' && end[1] != '\0')
+    {
+        return -1;
+    }
+
+    return (long long)(value * 1e9);
+}
+
+/*************************************************
+Function: parseSignal()
+Description: parses a signal number or name, with
+or without the SIG prefix, -1 if unknown
+*************************************************/
+static int parseSignal(const char *text)
+{
+    static const struct
+    {
+        const char *name;
+        int sig;
+    } names[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+        {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}};
+
+    if (isdigit((unsigned char)*text))
+    {
+        return atoi(text);
+    }
+
+    if (!strncasecmp(text, "SIG", 3))
+    {
+        text += 3;
+    }
+
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (!strcasecmp(text, names[i].name))
+        {
+            return names[i].sig;
+        }
+    }
+
+    return -1;
+}
+
+/*************************************************
+Function: nextWord()
+Description: returns the next space separated word
+of the string and moves past it
+*************************************************/
+static char *nextWord(char **c)
+{
+    char *word;
+
+    while (**c == ' ')
+        (*c)++;
+
+    if (**c == '\0')
+    {
+        return NULL;
+    }
+
+    word = *c;
+    while (**c && **c != ' ')
+        (*c)++;
+
+    if (**c)
+    {
+        *(*c)++ = '\0';
+    }
+
+    return word;
+}
+
+/*************************************************
+Function: timeoutCustom()
+Description: built-in timeout function, parses
+[-s SIG] [-k KILL_AFTER] DURATION and keeps the
+deadline for the command that follows, which is
+returned, or NULL after printing the usage
+*************************************************/
+char *timeoutCustom(char *c)
+{
+    char *word;
+    long long duration = -1;
+    long long killAfter = 0;
+    int sig = SIGTERM;
+
+    while ((word = nextWord(&c)) != NULL)
+    {
+        if (!strcmp(word, "-s"))
+        {
+            word = nextWord(&c);
+            if (word == NULL || (sig = parseSignal(word)) <= 0)
+            {
+                break;
+            }
+        }
+        else if (!strcmp(word, "-k"))
+        {
+            word = nextWord(&c);
+            if (word == NULL || (killAfter = parseDuration(word)) < 0)
+            {
+                break;
+            }
+        }
+        else
+        {
+            duration = parseDuration(word);
+            break;
+        }
+    }
+
+    while (*c == ' ')
+        c++;
+
+    if (duration < 0 || *c == '\0')
+    {
+        printf("timeout: usage: timeout [-s SIG] [-k KILL_AFTER] DURATION command\n");
+        fflush(stdout);
+        return NULL;
+    }
+
+    pendingTimeout = 1;
+    pendingDuration = duration;
+    pendingKillAfter = killAfter;
+    pendingSignal = sig;
+
+    return c;
+}
+
+/*************************************************
+Function: timeoutPending()
+Description: returns 1 if the next command started
+should get a deadline
+*************************************************/
+int timeoutPending()
+{
+    return pendingTimeout;
+}
+
+/*************************************************
+Function: clearTimeout()
+Description: drops a deadline no command took, for
+instance after timeout in front of a built in
+*************************************************/
+void clearTimeout()
+{
+    pendingTimeout = 0;
+}
+
+/*************************************************
+Function: armTimeout()
+Description: gives the pending deadline to a newly
+started command, which leads its own process group
+*************************************************/
+void armTimeout(int pid)
+{
+    if (!pendingTimeout)
+    {
+        return;
+    }
+    pendingTimeout = 0;
+
+    if (deadlineFd == -1)
+    {
+        deadlineFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+
+    if (deadlineSize == deadlineCapacity)
+    {
+        deadlineCapacity = deadlineCapacity ? deadlineCapacity * 2 : 16;
+        deadlines = realloc(deadlines, deadlineCapacity * sizeof(struct Deadline));
+    }
+
+    struct Deadline *d = &deadlines[deadlineSize];
+    d->when = nowNanos() + pendingDuration;
+    d->killAfter = pendingKillAfter;
+    d->pid = pid;
+    d->sig = pendingSignal;
+    d->fired = 0;
+
+    siftUp(deadlineSize++);
+    armTimer();
+}
+
+/*************************************************
+Function: cancelDeadline()
+Description: removes the deadline of a command that
+has been reaped, returns 1 if it had fired
+*************************************************/
+int cancelDeadline(int pid)
+{
+    for (int i = 0; i < deadlineSize; i++)
+    {
+        if (deadlines[i].pid == pid)
+        {
+            int fired = deadlines[i].fired;
+
+            deadlines[i] = deadlines[--deadlineSize];
+            if (i < deadlineSize)
+            {
+                siftUp(i);
+                siftDown(i);
+            }
+            armTimer();
+
+            return fired;
+        }
+    }
+
+    return 0;
+}
+
+/*************************************************
+Function: hasDeadlines()
+Description: returns 1 if a deadline is still due
+*************************************************/
+int hasDeadlines()
+{
+    return deadlineSize > 0 && deadlines[0].when != NEVER;
+}
+
+/*************************************************
+Function: timerFd()
+Description: the timerfd that becomes readable when
+the earliest deadline is due, -1 if none was made
+*************************************************/
+int timerFd()
+{
+    return deadlineFd;
+}
+
+/*************************************************
+Function: hasExited()
+Description: returns 1 if a timed command has
+exited but not been reaped yet, its own child is
+checked without reaping it and a child of the spawn
+helper by the helper's reply
+*************************************************/
+static int hasExited(int pid)
+{
+    siginfo_t info;
+
+    info.si_pid = 0;
+    if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0)
+    {
+        return info.si_pid == pid;
+    }
+
+    return helperChildExited(pid);
+}
+
+/*************************************************
+Function: fireDeadlines()
+Description: signals the process group of every
+command whose deadline has passed, a deadline with
+a kill delay is put back to send SIGKILL later
+*************************************************/
+void fireDeadlines()
+{
+    unsigned long long expirations;
+    long long now = nowNanos();
+
+    if (deadlineFd != -1)
+    {
+        read(deadlineFd, &expirations, sizeof(expirations));
+    }
+
+    while (deadlineSize > 0 && deadlines[0].when <= now)
+    {
+        struct Deadline *d = &deadlines[0];
+
+        // finished in time but not reaped yet, signalling now
+        // would report a time out or hit a reused group
+        if (hasExited(d->pid))
+        {
+            d->when = NEVER;
+            siftDown(0);
+            continue;
+        }
+
+        kill(-d->pid, d->sig);
+        d->fired = 1;
+
+        // a stopped process only gets the signal once it is
+        // continued, as coreutils timeout does
+        if (d->sig != SIGKILL && d->sig != SIGCONT)
+        {
+            kill(-d->pid, SIGCONT);
+        }
+
+        if (d->killAfter > 0)
+        {
+            d->when = now + d->killAfter;
+            d->sig = SIGKILL;
+            d->killAfter = 0;
+        }
+        else
+        {
+            d->when = NEVER;
+        }
+
+        siftDown(0);
+    }
+
+    armTimer();
+}
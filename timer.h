@@ -0,0 +1,17 @@
+#ifndef TIMER_INCLUDED
+#define TIMER_INCLUDED
+
+// set in a wait status when the command was stopped by
+// timeout, clear of the bits the W* macros look at
+#define STATUS_TIMED_OUT 0x10000
+
+char *timeoutCustom(char *);
+int timeoutPending();
+void armTimeout(int);
+void clearTimeout();
+int cancelDeadline(int);
+int hasDeadlines();
+int timerFd();
+void fireDeadlines();
+
+#endif
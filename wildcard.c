@@ -0,0 +1,807 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wildcard.h"
+
+#define DENTS_BUF 65536
+#define MAX_CACHED_DIRS 64
+
+enum
+{
+    OP_CHAR,  // one literal character
+    OP_ANY,   // ?
+    OP_STAR,  // *
+    OP_CLASS  // [...]
+};
+
+// one step of a compiled pattern component, set is a
+// 256 bit map of the characters a class accepts
+struct GlobOp
+{
+    unsigned char kind;
+    unsigned char ch;
+    unsigned char set[32];
+};
+
+// block of memory handed out by arenaAlloc(), all
+// names in a directory listing are freed together
+struct ArenaChunk
+{
+    struct ArenaChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+struct DirEntry
+{
+    char *name;
+    unsigned char type;
+};
+
+// cached listing of one directory, it is valid for as
+// long as the directory's dev, ino and mtime match
+struct DirListing
+{
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    int racy; // read within a clock tick of mtime, not trusted
+    struct DirEntry *entries;
+    int size;
+    int capacity;
+    struct ArenaChunk *arena;
+    struct DirListing *next;
+};
+
+// record layout returned by getdents64
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// growable list of expanded words
+struct WildList
+{
+    char **items;
+    int size;
+    int capacity;
+};
+
+struct DirListing *dirCache = NULL; // most recently used first
+struct DirListing *dirRetired = NULL; // stale listings waiting to be freed
+int dirCacheSize = 0;
+
+/*************************************************
+Function: arenaAlloc()
+Description: hands out size bytes from the arena,
+starting a new chunk of at least hint bytes when the
+current one is full
+*************************************************/
+static void *arenaAlloc(struct ArenaChunk **arena, size_t size, size_t hint)
+{
+    struct ArenaChunk *chunk = *arena;
+
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        size_t chunkSize = size > hint ? size : hint;
+
+        chunk = malloc(sizeof(struct ArenaChunk) + chunkSize);
+        chunk->next = *arena;
+        chunk->used = 0;
+        chunk->size = chunkSize;
+        *arena = chunk;
+    }
+
+    void *p = chunk->data + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+/*************************************************
+Function: freeListing()
+Description: frees a directory listing along with
+every chunk of its arena
+*************************************************/
+static void freeListing(struct DirListing *l)
+{
+    struct ArenaChunk *chunk = l->arena;
+
+    while (chunk != NULL)
+    {
+        struct ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(l->entries);
+    free(l);
+}
+
+/*************************************************
+Function: isRacy()
+Description: returns 1 if a directory was read too
+soon after it changed for its mtime to show a later
+change, as the clock behind file times is coarse, in
+the way git treats racy index entries
+*************************************************/
+static int isRacy(const struct timespec *mtime)
+{
+    struct timespec now;
+    struct timespec res;
+    long long tick = 1000000000LL;
+
+    // whole second mtimes come from a filesystem that
+    // keeps no finer times, keep the full second then
+    if (mtime->tv_nsec != 0 && clock_getres(CLOCK_REALTIME_COARSE, &res) == 0)
+    {
+        tick = res.tv_sec * 1000000000LL + res.tv_nsec;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    long long age = (now.tv_sec - mtime->tv_sec) * 1000000000LL + (now.tv_nsec - mtime->tv_nsec);
+    return age <= tick;
+}
+
+/*************************************************
+Function: readListing()
+Description: reads every entry of a directory with
+getdents64 into a new listing, names are copied
+into the listing's arena
+*************************************************/
+static struct DirListing *readListing(const char *path)
+{
+    static long buf[DENTS_BUF / sizeof(long)];
+    struct DirListing *l;
+    struct stat st;
+    long n;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    l = malloc(sizeof(struct DirListing));
+    l->dev = st.st_dev;
+    l->ino = st.st_ino;
+    l->mtime = st.st_mtim;
+    l->racy = isRacy(&st.st_mtim); // checked before reading, so it errs on the safe side
+    l->size = 0;
+    l->capacity = 64;
+    l->entries = malloc(l->capacity * sizeof(struct DirEntry));
+    l->arena = NULL;
+    l->next = NULL;
+
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0)
+    {
+        for (long pos = 0; pos < n;)
+        {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)((char *)buf + pos);
+            pos += d->d_reclen;
+
+            // never expand to . or ..
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+                                        (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+            {
+                continue;
+            }
+
+            if (l->size == l->capacity)
+            {
+                l->capacity *= 2;
+                l->entries = realloc(l->entries, l->capacity * sizeof(struct DirEntry));
+            }
+
+            size_t len = strlen(d->d_name) + 1;
+            // the rest of the batch bounds the names still to come,
+            // so a small directory gets a small chunk
+            l->entries[l->size].name = arenaAlloc(&l->arena, len, n - pos + d->d_reclen);
+            memcpy(l->entries[l->size].name, d->d_name, len);
+            l->entries[l->size].type = d->d_type;
+            l->size++;
+        }
+    }
+
+    close(fd);
+    return l;
+}
+
+/*************************************************
+Function: getListing()
+Description: returns the listing for a directory,
+reusing the cached copy while its dev, ino and
+mtime are unchanged and rereading it otherwise, or
+if it was racy when read, once the cache is full a
+new listing is not kept and owned is set so the
+caller frees it, which bounds the cache during a
+recursive walk
+*************************************************/
+static struct DirListing *getListing(const char *path, int *owned)
+{
+    struct DirListing **link = &dirCache;
+    struct DirListing *l;
+    struct stat st;
+
+    *owned = 0;
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode))
+    {
+        return NULL;
+    }
+
+    for (l = dirCache; l != NULL; link = &l->next, l = l->next)
+    {
+        if (l->dev == st.st_dev && l->ino == st.st_ino)
+        {
+            *link = l->next; // unlink, it moves to the front below
+
+            if (!l->racy && l->mtime.tv_sec == st.st_mtim.tv_sec &&
+                l->mtime.tv_nsec == st.st_mtim.tv_nsec)
+            {
+                l->next = dirCache;
+                dirCache = l;
+                return l;
+            }
+
+            // stale, an expansion may still be walking it so
+            // it is only freed by the next trimDirCache()
+            l->next = dirRetired;
+            dirRetired = l;
+            dirCacheSize--;
+            break;
+        }
+    }
+
+    l = readListing(path);
+    if (l != NULL && dirCacheSize >= MAX_CACHED_DIRS)
+    {
+        *owned = 1;
+    }
+    else if (l != NULL)
+    {
+        l->next = dirCache;
+        dirCache = l;
+        dirCacheSize++;
+    }
+
+    return l;
+}
+
+/*************************************************
+Function: trimDirCache()
+Description: frees retired listings and drops the
+least recently used ones beyond the cache size,
+only called between expansions so no listing is
+freed while it is being walked
+*************************************************/
+static void trimDirCache()
+{
+    struct DirListing *l;
+
+    while (dirRetired != NULL)
+    {
+        l = dirRetired;
+        dirRetired = l->next;
+        freeListing(l);
+    }
+
+    if (dirCacheSize <= MAX_CACHED_DIRS)
+    {
+        return;
+    }
+
+    l = dirCache;
+    for (int i = 1; i < MAX_CACHED_DIRS; i++)
+    {
+        l = l->next;
+    }
+
+    struct DirListing *extra = l->next;
+    l->next = NULL;
+    dirCacheSize = MAX_CACHED_DIRS;
+
+    while (extra != NULL)
+    {
+        l = extra;
+        extra = l->next;
+        freeListing(l);
+    }
+}
+
+/*************************************************
+Function: clearDirCache()
+Description: frees every cached directory listing
+*************************************************/
+void clearDirCache()
+{
+    while (dirCache != NULL)
+    {
+        struct DirListing *l = dirCache;
+        dirCache = l->next;
+        freeListing(l);
+    }
+    dirCacheSize = 0;
+    trimDirCache();
+}
+
+/*************************************************
+Function: hasWildcard()
+Description: returns 1 if the word contains any of
+the *, ? or [ pattern characters
+*************************************************/
+int hasWildcard(const char *word)
+{
+    return strpbrk(word, "*?[") != NULL;
+}
+
+/*************************************************
+Function: compilePattern()
+Description: compiles one path component of a
+pattern into an array of ops so that bracket
+classes are parsed once rather than per name
+*************************************************/
+static struct GlobOp *compilePattern(const char *p, int *num)
+{
+    struct GlobOp *ops = malloc((strlen(p) + 1) * sizeof(struct GlobOp));
+    int n = 0;
+
+    while (*p)
+    {
+        struct GlobOp *op = &ops[n];
+        memset(op, 0, sizeof(struct GlobOp));
+
+        if (*p == '*')
+        {
+            // runs of stars are the same as one
+            if (n == 0 || ops[n - 1].kind != OP_STAR)
+            {
+                op->kind = OP_STAR;
+                n++;
+            }
+            p++;
+            continue;
+        }
+
+        if (*p == '?')
+        {
+            op->kind = OP_ANY;
+            n++;
+            p++;
+            continue;
+        }
+
+        if (*p == '[')
+        {
+            const unsigned char *q = (const unsigned char *)p + 1;
+            int negate = 0;
+
+            if (*q == '!' || *q == '^')
+            {
+                negate = 1;
+                q++;
+            }
+
+            // a ] straight after the opening bracket is literal
+            const unsigned char *first = q;
+            while (*q && (*q != ']' || q == first))
+            {
+                unsigned char lo = *q;
+                unsigned char hi = *q;
+
+                if (q[1] == '-' && q[2] && q[2] != ']')
+                {
+                    hi = q[2];
+                    q += 2;
+                }
+
+                for (int c = lo; c <= hi; c++)
+                {
+                    op->set[c >> 3] |= 1 << (c & 7);
+                }
+                q++;
+            }
+
+            if (*q == ']')
+            {
+                if (negate)
+                {
+                    for (int i = 0; i < 32; i++)
+                    {
+                        op->set[i] = ~op->set[i];
+                    }
+                }
+                op->kind = OP_CLASS;
+                n++;
+                p = (const char *)q + 1;
+                continue;
+            }
+
+            // no closing bracket, match [ literally
+            memset(op->set, 0, sizeof(op->set));
+        }
+
+        if (*p == '\\' && p[1])
+        {
+            p++;
+        }
+
+        op->kind = OP_CHAR;
+        op->ch = *p;
+        n++;
+        p++;
+    }
+
+    *num = n;
+    return ops;
+}
+
+/*************************************************
+Function: matchPattern()
+Description: matches a name against compiled ops,
+backtracking only to the most recent star, names
+starting with . need a literal . in the pattern
+*************************************************/
+static int matchPattern(struct GlobOp *ops, int n, const char *name)
+{
+    const unsigned char *s = (const unsigned char *)name;
+    const unsigned char *starS = NULL;
+    int starP = -1;
+    int p = 0;
+
+    if (*s == '.' && (n == 0 || ops[0].kind != OP_CHAR))
+    {
+        return 0;
+    }
+
+    while (*s)
+    {
+        if (p < n && ops[p].kind == OP_STAR)
+        {
+            starP = ++p;
+            starS = s;
+            continue;
+        }
+
+        if (p < n && ((ops[p].kind == OP_CHAR && ops[p].ch == *s) ||
+                      ops[p].kind == OP_ANY ||
+                      (ops[p].kind == OP_CLASS && (ops[p].set[*s >> 3] & (1 << (*s & 7))))))
+        {
+            p++;
+            s++;
+            continue;
+        }
+
+        if (starP == -1)
+        {
+            return 0;
+        }
+
+        // let the last star swallow one more character
+        p = starP;
+        s = ++starS;
+    }
+
+    while (p < n && ops[p].kind == OP_STAR)
+    {
+        p++;
+    }
+
+    return p == n;
+}
+
+/*************************************************
+Function: addWild()
+Description: appends a word to the expansion list
+*************************************************/
+static void addWild(struct WildList *out, char *word)
+{
+    if (out->size == out->capacity)
+    {
+        out->capacity *= 2;
+        out->items = realloc(out->items, out->capacity * sizeof(char *));
+    }
+    out->items[out->size++] = word;
+}
+
+/*************************************************
+Function: joinPath()
+Description: returns a new string of the prefix,
+the name and an optional trailing slash
+*************************************************/
+static char *joinPath(const char *prefix, const char *name, int slash)
+{
+    size_t a = strlen(prefix);
+    size_t b = strlen(name);
+    char *path = malloc(a + b + 2);
+
+    memcpy(path, prefix, a);
+    memcpy(path + a, name, b);
+    if (slash)
+    {
+        path[a + b++] = '/';
+    }
+    path[a + b] = '\0';
+
+    return path;
+}
+
+/*************************************************
+Function: isDirectory()
+Description: uses the type from getdents64 when the
+filesystem provides one, otherwise stats the path,
+symlinks are only followed when asked to
+*************************************************/
+static int isDirectory(const char *prefix, struct DirEntry *e, int follow)
+{
+    struct stat st;
+    int result;
+
+    if (e->type == DT_DIR)
+    {
+        return 1;
+    }
+
+    if (e->type != DT_UNKNOWN && !(follow && e->type == DT_LNK))
+    {
+        return 0;
+    }
+
+    char *path = joinPath(prefix, e->name, 0);
+    result = (follow ? stat(path, &st) : lstat(path, &st)) == 0 && S_ISDIR(st.st_mode);
+    free(path);
+
+    return result;
+}
+
+/*************************************************
+Function: globAll()
+Description: adds every entry under the prefix,
+recursing into subdirectories, used for a trailing
+** component
+*************************************************/
+static void globAll(const char *prefix, struct WildList *out)
+{
+    int owned;
+    struct DirListing *l = getListing(*prefix ? prefix : ".", &owned);
+
+    if (l == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < l->size; i++)
+    {
+        if (l->entries[i].name[0] == '.')
+        {
+            continue;
+        }
+
+        addWild(out, joinPath(prefix, l->entries[i].name, 0));
+
+        if (isDirectory(prefix, &l->entries[i], 0))
+        {
+            char *sub = joinPath(prefix, l->entries[i].name, 1);
+            globAll(sub, out);
+            free(sub);
+        }
+    }
+
+    if (owned)
+    {
+        freeListing(l);
+    }
+}
+
+/*************************************************
+Function: globSearch()
+Description: expands the pattern components from
+idx onwards below the prefix, literal components
+are not listed, ** matches zero or more directories
+*************************************************/
+static void globSearch(const char *prefix, char **comps, int ncomp, int idx, struct WildList *out)
+{
+    char *comp = comps[idx];
+    int last = idx == ncomp - 1;
+    struct DirListing *l;
+    int owned;
+
+    if (!hasWildcard(comp))
+    {
+        if (last)
+        {
+            struct stat st;
+            char *path = joinPath(prefix, comp, 0);
+
+            if (lstat(path, &st) == 0)
+            {
+                addWild(out, path);
+            }
+            else
+            {
+                free(path);
+            }
+        }
+        else
+        {
+            char *sub = joinPath(prefix, comp, 1);
+            globSearch(sub, comps, ncomp, idx + 1, out);
+            free(sub);
+        }
+        return;
+    }
+
+    if (!strcmp(comp, "**"))
+    {
+        if (last)
+        {
+            globAll(prefix, out);
+            return;
+        }
+
+        // zero directories, then each directory below this one
+        globSearch(prefix, comps, ncomp, idx + 1, out);
+
+        l = getListing(*prefix ? prefix : ".", &owned);
+        if (l == NULL)
+        {
+            return;
+        }
+
+        for (int i = 0; i < l->size; i++)
+        {
+            if (l->entries[i].name[0] != '.' && isDirectory(prefix, &l->entries[i], 0))
+            {
+                char *sub = joinPath(prefix, l->entries[i].name, 1);
+                globSearch(sub, comps, ncomp, idx, out);
+                free(sub);
+            }
+        }
+
+        if (owned)
+        {
+            freeListing(l);
+        }
+        return;
+    }
+
+    l = getListing(*prefix ? prefix : ".", &owned);
+    if (l == NULL)
+    {
+        return;
+    }
+
+    int numOps;
+    struct GlobOp *ops = compilePattern(comp, &numOps);
+
+    for (int i = 0; i < l->size; i++)
+    {
+        if (!matchPattern(ops, numOps, l->entries[i].name))
+        {
+            continue;
+        }
+
+        if (last)
+        {
+            addWild(out, joinPath(prefix, l->entries[i].name, 0));
+        }
+        else if (isDirectory(prefix, &l->entries[i], 1))
+        {
+            char *sub = joinPath(prefix, l->entries[i].name, 1);
+            globSearch(sub, comps, ncomp, idx + 1, out);
+            free(sub);
+        }
+    }
+
+    free(ops);
+    if (owned)
+    {
+        freeListing(l);
+    }
+}
+
+/*************************************************
+Function: compareWords()
+Description: qsort comparison for expanded words
+*************************************************/
+static int compareWords(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*************************************************
+Function: expandWildcard()
+Description: splits a pattern on / and adds its
+sorted matches to the list
+*************************************************/
+static void expandWildcard(const char *pattern, struct WildList *out)
+{
+    char *copy = strdup(pattern);
+    char *comps[strlen(pattern) + 1];
+    int ncomp = 0;
+    int before = out->size;
+    char *p = copy;
+
+    // a leading / anchors the search at the root
+    const char *prefix = "";
+    if (*p == '/')
+    {
+        prefix = "/";
+        p++;
+    }
+
+    comps[ncomp++] = p;
+    for (; *p; p++)
+    {
+        if (*p == '/')
+        {
+            *p = '\0';
+            comps[ncomp++] = p + 1;
+        }
+    }
+
+    globSearch(prefix, comps, ncomp, 0, out);
+    qsort(out->items + before, out->size - before, sizeof(char *), compareWords);
+
+    free(copy);
+}
+
+/*************************************************
+Function: expandWildcards()
+Description: replaces each argument after the
+command name that contains a pattern with its
+matches, a pattern with no matches is passed on
+as written, returns a new NULL terminated array
+and updates the argument count
+*************************************************/
+char **expandWildcards(char **args, int *num)
+{
+    struct WildList out;
+
+    out.capacity = *num + 1;
+    out.size = 0;
+    out.items = malloc(out.capacity * sizeof(char *));
+
+    trimDirCache();
+
+    for (int i = 0; i < *num; i++)
+    {
+        int before = out.size;
+
+        if (i > 0 && hasWildcard(args[i]))
+        {
+            expandWildcard(args[i], &out);
+        }
+
+        if (out.size == before)
+        {
+            addWild(&out, args[i]);
+        }
+    }
+
+    *num = out.size;
+    addWild(&out, NULL);
+
+    free(args);
+    return out.items;
+}
@@ -0,0 +1,8 @@
+#ifndef WILDCARD_INCLUDED
+#define WILDCARD_INCLUDED
+
+int hasWildcard(const char *);
+char **expandWildcards(char **, int *);
+void clearDirCache();
+
+#endif